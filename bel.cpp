@@ -1,9 +1,9 @@
 
 //#define LISP_IMPLEMENTATION
+#define LISP_CLOSURE_ACCEPT_LISTS 1
 #include "lisp.hpp"
 
-#define LISP_SYM_LIT intern("lit")
-#define LISP_SYM_CLO intern("clo")
+#include <time.h>
 
 namespace lisp {
 
@@ -19,6 +19,7 @@ public:
     int main(int argc, char ** argv)
     {
         Expr env = make_env(nil);
+        GcRoot const env_root(env);
 
         lang_defspecial_quote(env);
         lang_defspecial_while(env); // TODO should be a macro
@@ -28,10 +29,9 @@ public:
             return list(LISP_SYM_LIT, LISP_SYM_CLO, env, car(args), cdr(args));
         });
 
-        lang_defun(env, "coin", [this](Expr args, Expr) -> Expr
+        lang_defun_typed(env, "coin", []() -> bool
         {
-            LISP_ASSERT(args == nil);
-            return (rand() & 1) ? LISP_SYMBOL_T : nil;
+            return rand() & 1;
         });
 
         lang_defun_println(env, "prn");
@@ -0,0 +1,25 @@
+;;; cons-heavy benchmark, run with: ./std load std.lisp bench.cons.lisp
+
+(defun iota (n acc)
+  (if (eq n 0)
+      acc
+      (iota (- n 1) (cons n acc))))
+
+(defun reverse (seq acc)
+  (if seq
+      (reverse (cdr seq) (cons (car seq) acc))
+      acc))
+
+;; long-lived data that a full collection has to trace every time
+(def old nil)
+(def i 0)
+(while (< i 200)
+  (def old (cons (map (lambda (n) (list n n n)) (iota 100 nil)) old))
+  (def i (+ i 1)))
+
+(def i 0)
+(while (< i 500)
+  (reverse (map (lambda (n) (cons n n)) (iota 100 nil)) nil)
+  (def i (+ i 1)))
+
+(gc-stats)
@@ -0,0 +1,16 @@
+;;; call-heavy benchmark, run with: time ./std load std.lisp bench.fib.lisp
+
+(defun fib (n)
+  (if (< n 2)
+      n
+      (+ (fib (- n 1)) (fib (- n 2)))))
+
+(defun tak (x y z)
+  (if (not (< y x))
+      z
+      (tak (tak (- x 1) y z)
+           (tak (- y 1) z x)
+           (tak (- z 1) x y))))
+
+(println (fib 25))
+(println (tak 18 12 6))
@@ -0,0 +1,31 @@
+;;; let-heavy benchmark, run with: time ./std load std.lisp bench.let.lisp
+
+;; nested lets and conds in a loop, once in a closure and once at top
+;; level, where each form is evaluated as it is
+
+(defun classify (n)
+  (let ((a (number-+ n 1)))
+    (let* ((b (number-+ a 1))
+           (c (number-+ b 1)))
+      (cond ((eq c 0) 'zero)
+            ((when (eq a b) t) 'same)
+            ((unless (eq n 1) (eq n 2)) 'small)
+            (t (let ((d c)) (progn d 'other)))))))
+
+(def i 0)
+(def sum nil)
+(while (not (eq i 200000))
+  (def sum (classify i))
+  (def i (number-+ i 1)))
+
+(println sum)
+
+(def i 0)
+(while (not (eq i 20000))
+  (def sum (let ((a i))
+             (let* ((b a) (c b))
+               (cond ((eq c 1) 'one)
+                     (t (progn a b c 'many))))))
+  (def i (number-+ i 1)))
+
+(println sum)
@@ -0,0 +1,32 @@
+;;; loop-heavy benchmark, run with: time ./std load std.lisp bench.loop.lisp
+
+;; every iteration looks up globals (while, <, +, def, the defuns below)
+;; from a few frames deep
+
+(defun add3 (a b c)
+  (+ a (+ b c)))
+
+(defun step (n)
+  (add3 n 1 (if (eq (cadr (list n n)) n) 0 1)))
+
+(def i 0)
+(def sum 0)
+(while (< i 100000)
+  (def sum (step sum))
+  (def i (+ i 1)))
+
+(println sum)
+
+;; and locals from nested lets, a frame or two out
+
+(defun deep (a b c)
+  (let ((d (+ a b)))
+    (let ((e (+ d c)))
+      (+ a b c d e))))
+
+(def i 0)
+(while (< i 30000)
+  (def sum (deep i 1 2))
+  (def i (+ i 1)))
+
+(println sum)
@@ -0,0 +1,307 @@
+
+/* the benchmarks reach into the stores, so pull in the implementation first */
+#define LISP_IMPLEMENTATION
+#include "lisp.hpp"
+
+#include <chrono>
+
+namespace lisp {
+
+/* the interner as it was before the hash index, kept as a baseline */
+class LinearSymbolImpl
+{
+public:
+    LinearSymbolImpl(U64 type) : m_type(type)
+    {
+    }
+
+    Expr make(char const * name)
+    {
+        for (U64 index = 0; index < (U64) m_names.size(); ++index)
+        {
+            if (m_names[index] == name)
+            {
+                return make_expr(m_type, index);
+            }
+        }
+
+        U64 const index = (U64) m_names.size();
+        m_names.push_back(name);
+        return make_expr(m_type, index);
+    }
+
+private:
+    U64 m_type;
+    std::vector<std::string> m_names;
+};
+
+class BenchSystem
+{
+public:
+    int main(int argc, char ** argv)
+    {
+        if (argc < 2)
+        {
+            fail(NULL);
+        }
+
+        char const * cmd = argv[1];
+        if (!strcmp("intern", cmd))
+        {
+            U64 const count = argc > 2 ? strtoull(argv[2], NULL, 10) : UINT64_C(1000000);
+            U64 const linear_count = argc > 3 ? strtoull(argv[3], NULL, 10) : UINT64_C(20000);
+            bench_intern(count, linear_count);
+        }
+        else if (!strcmp("parse", cmd))
+        {
+            U64 const megs = argc > 2 ? strtoull(argv[2], NULL, 10) : UINT64_C(100);
+            bench_parse("data", megs, SEXPS_DATA);
+            bench_parse("prose", megs, SEXPS_PROSE);
+            bench_parse("numbers", megs, SEXPS_NUMBERS);
+            bench_parse("strings", megs, SEXPS_STRINGS);
+        }
+        else if (!strcmp("io", cmd))
+        {
+            U64 const megs = argc > 2 ? strtoull(argv[2], NULL, 10) : UINT64_C(100);
+            char const * path = argc > 3 ? argv[3] : "bench.io.tmp";
+            bench_io(megs, path);
+        }
+        else
+        {
+            fail("unknown command %s\n", cmd);
+        }
+        return 0;
+    }
+
+    template <typename Interner>
+    void bench_intern_with(char const * label, Interner & interner, U64 count)
+    {
+        /* half distinct names, half repeats of names already seen */
+        std::vector<std::string> names;
+        for (U64 i = 0; i < count; ++i)
+        {
+            U64 const id = i % 2 ? (i * UINT64_C(2654435761)) % (i / 2 + 1) : i / 2;
+            char buf[32];
+            snprintf(buf, sizeof(buf), "sym-%" PRIu64, id);
+            names.push_back(buf);
+        }
+
+        auto const start = std::chrono::steady_clock::now();
+        U64 check = 0;
+        for (auto const & name : names)
+        {
+            check += expr_data(interner.make(name.c_str()));
+        }
+        auto const stop = std::chrono::steady_clock::now();
+
+        double const secs = std::chrono::duration<double>(stop - start).count();
+        printf("%-8s %10" PRIu64 " intern(s) in %8.3f s, %10.1f ns/intern (check %" PRIu64 ")\n",
+               label, count, secs, secs * 1e9 / count, check);
+    }
+
+    void bench_intern(U64 count, U64 linear_count)
+    {
+        {
+            SymbolImpl interner(TYPE_SYMBOL);
+            bench_intern_with("hashed", interner, count);
+        }
+        {
+            SymbolImpl interner(TYPE_SYMBOL);
+            bench_intern_with("hashed", interner, linear_count);
+        }
+        {
+            LinearSymbolImpl interner(TYPE_SYMBOL);
+            bench_intern_with("linear", interner, linear_count);
+        }
+    }
+
+    /* the reader and printer over an s-expression file of the given size */
+    enum
+    {
+        SEXPS_DATA,
+        SEXPS_PROSE,
+        SEXPS_NUMBERS,
+        SEXPS_STRINGS,
+    };
+
+    /* at least the given number of bytes of data-file like s-expressions,
+       source-like ones with long comments, docstrings and indentation,
+       rows of numbers, or string tables */
+    std::string make_sexps(U64 bytes, int shape = SEXPS_DATA)
+    {
+        std::string text;
+        for (U64 i = 0; text.size() < bytes; ++i)
+        {
+            char buf[512];
+            if (shape == SEXPS_NUMBERS)
+            {
+                snprintf(buf, sizeof(buf), "(%" PRIu64 " -%" PRIu64 ".125 %" PRIu64 ".5e7 0x%" PRIx64 " 42 -7 0.001 %" PRIu64 ")\n",
+                         i * 7919, i % 1000, i % 97, i * 31, i * 104729);
+                text += buf;
+                continue;
+            }
+            if (shape == SEXPS_STRINGS)
+            {
+                snprintf(buf, sizeof(buf),
+                         "(message %" PRIu64 " \"the configuration file could not be read, falling back to the defaults\"\n"
+                         "        \"check the permissions on the file and the directory it lives in\")\n",
+                         i);
+                text += buf;
+                continue;
+            }
+            if (shape == SEXPS_PROSE)
+            {
+                snprintf(buf, sizeof(buf),
+                         ";; helper number %" PRIu64 ", kept around because the loader still calls it from the old entry points\n"
+                         "(defun helper-%" PRIu64 " (some-argument another-argument)\n"
+                         "        \"Combines some-argument with another-argument the way the old loader expected,\n"
+                         "        see the notes next to the entry points for the details.\"\n"
+                         "        (combine-with-the-old-rules some-argument another-argument))\n\n",
+                         i, i);
+                text += buf;
+                continue;
+            }
+            if (i % 8 == 0)
+            {
+                snprintf(buf, sizeof(buf), "; entries from %" PRIu64 " on\n", i);
+                text += buf;
+            }
+            snprintf(buf, sizeof(buf), "(entry %" PRIu64 " \"name-%" PRIu64 "\" (tags alpha beta gamma) (pos %" PRIu64 ".5 -%" PRIu64 ") ((nested (deep %" PRIu64 "))))\n",
+                     i, i, i % 1000, i % 77, i % 13);
+            text += buf;
+        }
+        return text;
+    }
+
+    /* the reader alone, over a string in memory */
+    void bench_parse(char const * label, U64 megs, int shape)
+    {
+        std::string const text = make_sexps(megs << 20, shape);
+
+        auto const start = std::chrono::steady_clock::now();
+        Expr const in = make_string_input_stream(text.c_str());
+        U64 count = 0;
+        Expr exp = nil;
+        while (maybe_parse_expr(in, &exp))
+        {
+            if (++count % 4096 == 0)
+            {
+                gc_collect();
+            }
+        }
+        stream_release(in);
+        auto const stop = std::chrono::steady_clock::now();
+
+        double const secs = std::chrono::duration<double>(stop - start).count();
+        printf("%-8s %10" PRIu64 " expr(s) in %8.3f s, %8.1f MB/s\n",
+               label, count, secs, text.size() / secs / (1 << 20));
+    }
+
+    void bench_io(U64 megs, char const * path)
+    {
+        U64 const bytes = megs << 20;
+        {
+            FILE * file = fopen(path, "wb");
+            if (!file)
+            {
+                fail("cannot open %s\n", path);
+            }
+            std::string const text = make_sexps(bytes);
+            fwrite(text.data(), 1, text.size(), file);
+            fclose(file);
+        }
+
+        std::string const out_path = std::string(path) + ".out";
+        bench_chars_with("chars", path, NULL, bytes);
+        bench_chars_with("copy", path, out_path.c_str(), bytes);
+        bench_io_with("read", path, NULL, bytes);
+        bench_io_with("print", path, out_path.c_str(), bytes);
+        remove(out_path.c_str());
+        remove(path);
+    }
+
+    /* the stream layer alone, one char at a time */
+    void bench_chars_with(char const * label, char const * path, char const * out_path, U64 bytes)
+    {
+        auto const start = std::chrono::steady_clock::now();
+        Expr const in = make_file_input_stream_from_path(path);
+        Expr const out = out_path ? make_file_output_stream_from_path(out_path) : nil;
+        U64 count = 0;
+        for (U32 ch; (ch = stream_read_char(in)); ++count)
+        {
+            if (out_path)
+            {
+                stream_put_char(out, ch);
+            }
+        }
+        if (out_path)
+        {
+            stream_release(out);
+        }
+        stream_release(in);
+        auto const stop = std::chrono::steady_clock::now();
+
+        double const secs = std::chrono::duration<double>(stop - start).count();
+        printf("%-8s %10" PRIu64 " char(s) in %8.3f s, %8.1f MB/s\n",
+               label, count, secs, bytes / secs / (1 << 20));
+    }
+
+    void bench_io_with(char const * label, char const * path, char const * out_path, U64 bytes)
+    {
+        auto const start = std::chrono::steady_clock::now();
+        Expr const in = make_file_input_stream_from_path(path);
+        Expr const out = out_path ? make_file_output_stream_from_path(out_path) : nil;
+        U64 count = 0;
+        Expr exp = nil;
+        while (maybe_parse_expr(in, &exp))
+        {
+            if (out_path)
+            {
+                HashSet<Expr> seen;
+                g_print.print_expr(exp, out, seen);
+                stream_put_char(out, '\n');
+            }
+            /* nothing is rooted, so this drops the expressions read so far */
+            if (++count % 4096 == 0)
+            {
+                gc_collect();
+            }
+        }
+        if (out_path)
+        {
+            stream_release(out);
+        }
+        stream_release(in);
+        auto const stop = std::chrono::steady_clock::now();
+
+        double const secs = std::chrono::duration<double>(stop - start).count();
+        printf("%-8s %10" PRIu64 " expr(s) in %8.3f s, %8.1f MB/s\n",
+               label, count, secs, bytes / secs / (1 << 20));
+    }
+
+    void fail(char const * fmt, ...)
+    {
+        if (fmt)
+        {
+            va_list ap;
+            va_start(ap, fmt);
+            vfprintf(stderr, fmt, ap);
+            va_end(ap);
+        }
+        fprintf(stderr,
+                "usage: benchmark <command> <options>\n"
+                "commands:\n"
+                "  intern {N} {M} .. intern N names, and M names with the linear baseline\n"
+                "  parse {MB} ....... parse MB megabytes of s-expressions from memory\n"
+                "  io {MB} {FILE} ... copy, read, and print an s-expression file of MB megabytes\n"
+            );
+        exit(1);
+    }
+};
+
+}
+
+int main(int argc, char ** argv)
+{
+    return lisp::BenchSystem().main(argc, argv);
+}
@@ -51,12 +51,101 @@
 #define LISP_READER_PARSE_CHARACTER 1
 #endif
 
+/* scan in-memory input sixteen bytes at a time where sse2 is there */
+#ifndef LISP_READER_SIMD
+#define LISP_READER_SIMD 1
+#endif
+
 #ifndef LISP_PRINTER_PRINT_QUOTE
 #define LISP_PRINTER_PRINT_QUOTE 1
 #endif
 
+/* file streams read and write through blocks of this many bytes */
+#ifndef LISP_STREAM_BLOCK_SIZE
+#define LISP_STREAM_BLOCK_SIZE 65536
+#endif
+
+/* map regular files into memory instead of reading them in blocks */
+#ifndef LISP_STREAM_MMAP
+#define LISP_STREAM_MMAP 1
+#endif
+
 #ifndef LISP_CLOSURE_USE_CONS
-#define LISP_CLOSURE_USE_CONS 1
+#define LISP_CLOSURE_USE_CONS 0
+#endif
+
+/* also take (lit clo <env> <args> . <body>) lists as closures, for Bel */
+#ifndef LISP_CLOSURE_ACCEPT_LISTS
+#define LISP_CLOSURE_ACCEPT_LISTS LISP_CLOSURE_USE_CONS
+#endif
+
+#define LISP_EVAL_ENGINE_AST  0
+#define LISP_EVAL_ENGINE_TREE 1
+#define LISP_EVAL_ENGINE_VM   2
+
+#ifndef LISP_EVAL_ENGINE
+#define LISP_EVAL_ENGINE LISP_EVAL_ENGINE_VM
+#endif
+
+#ifndef LISP_EVAL_DEPTH_LIMIT
+#define LISP_EVAL_DEPTH_LIMIT 1000000
+#endif
+
+/* bytes of the stack of the thread the evaluators may recurse through,
+   0 for what is left of it less LISP_NATIVE_STACK_RESERVE, which is also
+   what they leave of a segment */
+#ifndef LISP_NATIVE_STACK_LIMIT
+#define LISP_NATIVE_STACK_LIMIT 0
+#endif
+
+#ifndef LISP_NATIVE_STACK_RESERVE
+#define LISP_NATIVE_STACK_RESERVE (256 * 1024)
+#endif
+
+/* past that the evaluators go on on segments of stack allocated on the
+   heap, up to LISP_EVAL_STACK_LIMIT bytes of them, or fail without */
+#ifndef LISP_EVAL_STACK_SEGMENTS
+#if defined(__linux__)
+#define LISP_EVAL_STACK_SEGMENTS 1
+#else
+#define LISP_EVAL_STACK_SEGMENTS 0
+#endif
+#endif
+
+#ifndef LISP_EVAL_SEGMENT_SIZE
+#define LISP_EVAL_SEGMENT_SIZE (1024 * 1024)
+#endif
+
+#ifndef LISP_EVAL_STACK_LIMIT
+#define LISP_EVAL_STACK_LIMIT (UINT64_C(128) << 20)
+#endif
+
+#ifndef LISP_SEGMENT_BITS
+#define LISP_SEGMENT_BITS 14
+#endif
+
+#ifndef LISP_SEGMENT_HUGEPAGES
+#define LISP_SEGMENT_HUGEPAGES 0
+#endif
+
+#ifndef LISP_SYMBOL_INDEX_SIZE
+#define LISP_SYMBOL_INDEX_SIZE 1024
+#endif
+
+#ifndef LISP_SYMBOL_CHUNK_SIZE
+#define LISP_SYMBOL_CHUNK_SIZE 65536
+#endif
+
+#ifndef LISP_GC_THRESHOLD
+#define LISP_GC_THRESHOLD 100000
+#endif
+
+#ifndef LISP_GC_GENERATIONAL
+#define LISP_GC_GENERATIONAL 1
+#endif
+
+#ifndef LISP_GC_NURSERY_SIZE
+#define LISP_GC_NURSERY_SIZE 65536
 #endif
 
 #line 2 "src/includes.decl"
@@ -67,19 +156,49 @@
 #include <stdbool.h>
 
 #include <assert.h>
+#include <errno.h>
 #include <inttypes.h>
 #include <string.h>
+#include <unistd.h>
 
+#include <algorithm>
+#include <chrono>
+#include <exception>
 #include <functional>
+#include <memory>
+#include <new>
 #include <string>
+#include <type_traits>
 #include <unordered_map>
 #include <unordered_set>
 #include <vector>
 
+#if LISP_READER_SIMD && defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 #if LISP_DEBUG_USE_SIGNAL
 #include <signal.h>
 #endif
 
+#if LISP_SEGMENT_HUGEPAGES || LISP_STREAM_MMAP
+#include <sys/mman.h>
+#endif
+
+#if LISP_STREAM_MMAP
+#include <fcntl.h>
+#include <sys/stat.h>
+#endif
+
+#if !LISP_NATIVE_STACK_LIMIT
+#include <pthread.h>
+#include <sys/resource.h>
+#endif
+
+#if LISP_EVAL_STACK_SEGMENTS
+#include <ucontext.h>
+#endif
+
 #line 2 "src/defines.decl"
 #define LISP_RED     "\x1b[31m"
 #define LISP_GREEN   "\x1b[32m"
@@ -272,6 +391,10 @@ enum
     TYPE_BUILTIN_SYMBOL,
     TYPE_CLOSURE_FUN,
     TYPE_CLOSURE_MAC,
+    TYPE_FRAME,
+    // produced by analysis, only found in analyzed code
+    TYPE_LOCAL_REF,
+    TYPE_GLOBAL_REF,
 };
 
 enum
@@ -304,13 +427,39 @@ inline static bool is_nil(Expr exp)
 namespace LISP_NAMESPACE {
 #endif
 
-#define LISP_SYMBOL_T intern("t")
+/* core symbols are interned first, in this order, so that they can be
+   compared against constants instead of going through intern */
+
+enum
+{
+    SYMBOL_QUOTE = 0,
+    SYMBOL_IF,
+    SYMBOL_LIT,
+    SYMBOL_CLO,
+    SYMBOL_MAC,
+    SYMBOL_BACKQUOTE,
+    SYMBOL_UNQUOTE,
+    SYMBOL_UNQUOTE_SPLICING,
+    SYMBOL_T,
+    SYMBOL_DOT,
+    SYMBOL_COUNT,
+};
+
+#define LISP_SYMBOL_NAMES "quote", "if", "lit", "clo", "mac", "backquote", "unquote", "unquote-splicing", "t", "."
+
+#define LISP_SYMBOL_EXPR(index) ((((Expr) (index)) << LISP_TYPE_BITS) | TYPE_SYMBOL)
+
+#define LISP_SYMBOL_T LISP_SYMBOL_EXPR(SYMBOL_T)
 
-#define LISP_SYM_QUOTE intern("quote")
-#define LISP_SYM_IF intern("if")
-#define LISP_SYM_BACKQUOTE intern("backquote")
-#define LISP_SYM_UNQUOTE intern("unquote")
-#define LISP_SYM_UNQUOTE_SPLICING intern("unquote-splicing")
+#define LISP_SYM_QUOTE LISP_SYMBOL_EXPR(SYMBOL_QUOTE)
+#define LISP_SYM_IF LISP_SYMBOL_EXPR(SYMBOL_IF)
+#define LISP_SYM_LIT LISP_SYMBOL_EXPR(SYMBOL_LIT)
+#define LISP_SYM_CLO LISP_SYMBOL_EXPR(SYMBOL_CLO)
+#define LISP_SYM_MAC LISP_SYMBOL_EXPR(SYMBOL_MAC)
+#define LISP_SYM_BACKQUOTE LISP_SYMBOL_EXPR(SYMBOL_BACKQUOTE)
+#define LISP_SYM_UNQUOTE LISP_SYMBOL_EXPR(SYMBOL_UNQUOTE)
+#define LISP_SYM_UNQUOTE_SPLICING LISP_SYMBOL_EXPR(SYMBOL_UNQUOTE_SPLICING)
+#define LISP_SYM_DOT LISP_SYMBOL_EXPR(SYMBOL_DOT)
 
 inline bool is_symbol(Expr exp)
 {
@@ -509,10 +658,12 @@ inline bool is_string(Expr exp)
 #if LISP_WANT_GLOBAL_API
 
 Expr make_string(char const * str);
+Expr make_string_bytes(char const * data, U64 size);
 Expr make_string_from_utf8(U8 const * str);
 Expr make_string_from_utf32_char(U32 code);
 char const * string_value(Expr exp);
 U8 const * string_value_utf8(Expr exp);
+char const * string_data(Expr exp);
 U64 string_length(Expr exp);
 bool string_equal(Expr exp1, Expr exp2);
 
@@ -527,6 +678,13 @@ bool string_equal(Expr exp1, Expr exp2);
 namespace LISP_NAMESPACE {
 #endif
 
+enum
+{
+    STREAM_FLUSH_FULL,
+    STREAM_FLUSH_LINE,
+    STREAM_FLUSH_ALWAYS,
+};
+
 struct StreamInfo
 {
     FILE * file;
@@ -536,6 +694,20 @@ struct StreamInfo
     char * buffer;
     size_t size;
     size_t cursor;
+    size_t peek_cursor;
+    bool mapped;
+
+    /* string output streams grow this instead */
+    std::string * text;
+
+    /* file streams go through a block of LISP_STREAM_BLOCK_SIZE bytes */
+    int fd;
+    bool output;
+    bool eof;
+    U8 flush_mode;
+    U8 * block;
+    size_t block_end;
+    size_t block_cursor;
 };
 
 inline bool is_stream(Expr exp)
@@ -546,14 +718,21 @@ inline bool is_stream(Expr exp)
 #if LISP_WANT_GLOBAL_API
 
 Expr make_file_input_stream_from_path(char const * path);
+Expr make_file_output_stream_from_path(char const * path);
 
 Expr make_string_input_stream(char const * str);
 Expr make_buffer_output_stream(size_t size, char * str);
+Expr make_string_output_stream();
+char const * stream_string_value(Expr exp);
 
 U32 stream_read_char(Expr exp);
 U32 stream_peek_char(Expr exp);
 void stream_skip_char(Expr exp);
 
+U8 const * stream_span(Expr exp, size_t * size);
+void stream_advance(Expr exp, size_t count);
+
+void stream_put_bytes(Expr exp, size_t size, U8 const * bytes);
 void stream_put_cchar(Expr exp, char ch);
 void stream_put_char(Expr exp, U32 ch);
 void stream_put_cstring(Expr exp, char const * str);
@@ -563,6 +742,7 @@ void stream_put_x64(Expr exp, U64 val);
 void stream_put_f32(Expr exp, F32 val);
 void stream_put_pointer(Expr exp, void const * ptr);
 
+void stream_flush(Expr exp);
 void stream_release(Expr exp);
 bool stream_at_end(Expr exp);
 
@@ -583,10 +763,71 @@ namespace LISP_NAMESPACE {
 
 typedef std::function<Expr(Expr args, Expr env)> BuiltinFunc;
 
+/* builtin functions can also take their args without a list, straight
+   from the value stack of the caller, either by arity or as a pointer
+   and a count, the pointer is only good until the builtin calls back
+   into the evaluator, so only leaf builtins should take it */
+
+typedef Expr (*BuiltinFunc1)(Expr arg1);
+typedef Expr (*BuiltinFunc2)(Expr arg1, Expr arg2);
+typedef Expr (*BuiltinFunc3)(Expr arg1, Expr arg2, Expr arg3);
+typedef Expr (*BuiltinFuncArgs)(Expr const * args, U64 argc);
+
+/* a fixed arity of any size, with data of the host for the function,
+   which the builtin owns */
+typedef Expr (*BuiltinFuncData)(void * data, Expr const * args);
+
+#define LISP_BUILTIN_MAX_ARITY 3
+
+enum
+{
+    BUILTIN_LIST,
+    BUILTIN_ARITY_1,
+    BUILTIN_ARITY_2,
+    BUILTIN_ARITY_3,
+    BUILTIN_ARGS,
+    BUILTIN_DATA,
+};
+
+/* the specials that the evaluators run themselves instead of calling
+   them, set by make_core_env, any other special, like one of the host
+   that takes the name of one of these, is called like it always is */
+
+enum
+{
+    SPECIAL_OTHER,
+    SPECIAL_QUOTE,
+    SPECIAL_IF,
+    SPECIAL_WHILE,
+    SPECIAL_DEF,
+    SPECIAL_LAMBDA,
+    SPECIAL_SYNTAX,
+    SPECIAL_BACKQUOTE,
+    SPECIAL_PROGN,
+    SPECIAL_LET,
+    SPECIAL_LET_STAR,
+    SPECIAL_COND,
+    SPECIAL_WHEN,
+    SPECIAL_UNLESS,
+    SPECIAL_AND,
+    SPECIAL_OR,
+    SPECIAL_FRAME_LET,
+    SPECIAL_FLAT_LAMBDA,
+};
+
 struct BuiltinInfo
 {
     char const * name;
+    U64 conv;
+    U64 kind;
     BuiltinFunc func;
+    BuiltinFunc1 func1;
+    BuiltinFunc2 func2;
+    BuiltinFunc3 func3;
+    BuiltinFuncArgs funcv;
+    BuiltinFuncData funcd;
+    std::shared_ptr<void> data;
+    U64 arity;
 };
 
 inline bool is_builtin_special(Expr exp)
@@ -611,11 +852,21 @@ inline bool is_builtin(Expr exp)
 
 #if LISP_WANT_GLOBAL_API
 Expr make_builtin_special(char const * name, BuiltinFunc func);
+Expr make_builtin_special_kind(char const * name, U64 kind, BuiltinFunc func);
 Expr make_builtin_function(char const * name, BuiltinFunc func);
 Expr make_builtin_symbol(char const * name, BuiltinFunc func);
+Expr make_builtin_function1(char const * name, BuiltinFunc1 func);
+Expr make_builtin_function2(char const * name, BuiltinFunc2 func);
+Expr make_builtin_function3(char const * name, BuiltinFunc3 func);
+Expr make_builtin_function_args(char const * name, BuiltinFuncArgs func);
+Expr make_builtin_function_data(char const * name, U64 arity, BuiltinFuncData func, std::shared_ptr<void> data);
 
 char const * builtin_name(Expr exp);
-BuiltinFunc builtin_func(Expr exp);
+U64 builtin_special_kind(Expr exp);
+BuiltinFunc const & builtin_func(Expr exp);
+
+Expr builtin_call(Expr exp, Expr const * args, U64 argc, Expr env);
+Expr builtin_apply(Expr exp, Expr vals, Expr env);
 #endif
 
 #ifdef LISP_NAMESPACE
@@ -637,6 +888,8 @@ Expr number_sub(Expr a, Expr b);
 Expr number_mul(Expr a, Expr b);
 Expr number_div(Expr a, Expr b);
 bool number_equal(Expr a, Expr b);
+bool number_lt(Expr a, Expr b);
+bool number_le(Expr a, Expr b);
 
 #ifdef LISP_NAMESPACE
 }
@@ -675,6 +928,15 @@ Expr second(Expr seq);
 Expr nreverse(Expr list);
 Expr append(Expr a, Expr b);
 
+U64 length(Expr seq);
+Expr reverse(Expr seq);
+Expr copy_list(Expr seq);
+Expr nthcdr(U64 n, Expr seq);
+Expr nth(U64 n, Expr seq);
+Expr last(Expr seq);
+Expr member(Expr item, Expr seq);
+Expr assoc(Expr key, Expr alist);
+
 void load_file(char const * path, Expr env);
 void repl(Expr env);
 
@@ -732,6 +994,7 @@ namespace LISP_NAMESPACE {
 Expr closure_env(Expr exp);
 Expr closure_args(Expr exp);
 Expr closure_body(Expr exp);
+Expr closure_name(Expr exp);
 
 bool is_function(Expr exp);
 Expr make_function(Expr env, Expr name, Expr args, Expr body);
@@ -743,6 +1006,31 @@ Expr make_macro(Expr env, Expr name, Expr args, Expr body);
 }
 #endif
 
+#line 2 "src/frame.decl"
+#ifdef LISP_NAMESPACE
+namespace LISP_NAMESPACE {
+#endif
+
+bool is_frame(Expr exp);
+Expr make_frame(Expr names, U64 size, Expr outer);
+
+Expr frame_names(Expr frame);
+Expr frame_outer(Expr frame);
+U64 frame_size(Expr frame);
+
+Expr frame_get(Expr frame, U64 slot);
+void frame_set(Expr frame, U64 slot, Expr val);
+
+Expr frame_extra(Expr frame);
+void frame_set_extra(Expr frame, Expr extra);
+
+void frame_bind(Expr frame, Expr vars, Expr vals);
+void frame_bind_values(Expr frame, Expr vars, Expr const * vals, U64 count);
+
+#ifdef LISP_NAMESPACE
+}
+#endif
+
 #line 2 "src/env.decl"
 #ifdef LISP_NAMESPACE
 namespace LISP_NAMESPACE {
@@ -761,6 +1049,99 @@ void env_set(Expr env, Expr var, Expr val);
 }
 #endif
 
+#line 2 "src/macro.decl"
+#ifdef LISP_NAMESPACE
+namespace LISP_NAMESPACE {
+#endif
+
+Expr expand_macro(Expr mac, Expr call);
+void forget_macro(Expr mac);
+
+Expr macroexpand_1(Expr exp, Expr env);
+Expr macroexpand(Expr exp, Expr env);
+Expr macroexpand_all(Expr exp, Expr env);
+Expr macroexpand_all_noting(Expr exp, Expr env, std::vector<Expr> & heads);
+
+bool macro_expand_on_load();
+void macro_set_expand_on_load(bool value);
+
+U64 macro_cache_hits();
+U64 macro_cache_misses();
+void macro_print_stats(FILE * file);
+
+#ifdef LISP_NAMESPACE
+}
+#endif
+
+#line 2 "src/analyze.decl"
+#ifdef LISP_NAMESPACE
+namespace LISP_NAMESPACE {
+#endif
+
+/* what a closure body looks like after analysis, refs to vars of the
+   call frame and the frames around it are replaced by local refs, refs
+   to anything else by global refs that skip those frames, the engine
+   that runs code first keeps what it makes of it here
+
+   an analysis goes stale when a global it expanded as a macro, ran as
+   a special or checked for either is rebound, engines that keep one
+   around check before they run it again, and it is dropped once the
+   outermost evaluation returns */
+
+struct TreeBody;
+
+struct Analysis
+{
+    Expr args;
+    Expr names;
+    U64 size;
+    Expr code;
+    bool dynamic;
+    bool stale;
+    std::vector<Expr> scope;
+    std::vector<U64> program;
+    std::shared_ptr<TreeBody> tree;
+};
+
+Expr make_local_ref(U64 depth, U64 slot);
+U64 local_ref_depth(Expr exp);
+U64 local_ref_slot(Expr exp);
+
+Expr make_global_ref(U64 depth, Expr var);
+U64 global_ref_depth(Expr exp);
+Expr global_ref_var(Expr exp);
+
+Analysis * closure_analysis(Expr exp);
+void forget_analyses(Expr var, Expr val);
+void drop_stale_analyses();
+U64 analyses_cached();
+
+#ifdef LISP_NAMESPACE
+}
+#endif
+
+#line 2 "src/vm.decl"
+#ifdef LISP_NAMESPACE
+namespace LISP_NAMESPACE {
+#endif
+
+Expr vm_call(Expr fun, Analysis * analysis, Expr vals);
+
+#ifdef LISP_NAMESPACE
+}
+#endif
+
+#line 2 "src/tree.decl"
+#ifdef LISP_NAMESPACE
+namespace LISP_NAMESPACE {
+#endif
+
+Expr tree_call(Expr fun, Analysis * analysis, Expr vals);
+
+#ifdef LISP_NAMESPACE
+}
+#endif
+
 #line 2 "src/eval.decl"
 #ifdef LISP_NAMESPACE
 namespace LISP_NAMESPACE {
@@ -769,7 +1150,84 @@ namespace LISP_NAMESPACE {
 Expr eval(Expr exp, Expr env);
 Expr eval_body(Expr exps, Expr env);
 
-Expr apply(Expr name, Expr args, Expr env);
+Expr apply(Expr name, Expr form, Expr env);
+Expr call_closure(Expr fun, Expr vals);
+Expr call_function(Expr fun, Expr vals, Expr env);
+
+Expr make_let_env(Expr decls, Expr env, bool sequential);
+Expr make_let_frame(Expr names, Expr inits, Expr env);
+
+void eval_enter();
+void eval_leave();
+
+/* functions the evaluators recurse through check for stack first, and
+   go on on a fresh segment if there is too little left, see EvalImpl */
+bool eval_stack_low();
+Expr eval_on_new_stack(std::function<Expr()> const & func);
+
+/* counts the evaluations under way, analyses are only dropped when there
+   are none */
+
+class EvalGuard
+{
+public:
+    EvalGuard()
+    {
+        eval_enter();
+    }
+
+    ~EvalGuard()
+    {
+        eval_leave();
+    }
+};
+
+#ifdef LISP_NAMESPACE
+}
+#endif
+
+#line 2 "src/gc.decl"
+#ifdef LISP_NAMESPACE
+namespace LISP_NAMESPACE {
+#endif
+
+#if LISP_WANT_GLOBAL_API
+
+void gc_push_root(Expr const * root);
+void gc_pop_root();
+
+void gc_protect(Expr exp);
+void gc_unprotect(Expr exp);
+
+void gc_safe_point();
+U64 gc_collect();
+U64 gc_collect_young();
+U64 gc_epoch();
+void gc_next_epoch();
+U64 gc_made();
+void gc_print_stats(FILE * file);
+
+/* keeps a host variable alive (and current) while in scope */
+
+class GcRoot
+{
+public:
+    GcRoot(Expr const & exp)
+    {
+        gc_push_root(&exp);
+    }
+
+    ~GcRoot()
+    {
+        gc_pop_root();
+    }
+
+private:
+    GcRoot(GcRoot const &);
+    GcRoot & operator=(GcRoot const &);
+};
+
+#endif
 
 #ifdef LISP_NAMESPACE
 }
@@ -785,6 +1243,15 @@ Expr make_core_env();
 void lang_def(Expr env, Expr var, Expr val);
 
 void lang_defun(Expr env, char const * name, BuiltinFunc func);
+void lang_defun1(Expr env, char const * name, BuiltinFunc1 func);
+void lang_defun2(Expr env, char const * name, BuiltinFunc2 func);
+void lang_defun3(Expr env, char const * name, BuiltinFunc3 func);
+void lang_defun_args(Expr env, char const * name, BuiltinFuncArgs func);
+
+/* binds a host function or lambda like I64(I64, I64) or F32(F32),
+   taking and returning Expr, I64, F32, bool or char const * */
+template <typename Func>
+void lang_defun_typed(Expr env, char const * name, Func func);
 void lang_defun_println(Expr env, char const * name);
 
 void lang_defspecial(Expr env, char const * name, BuiltinFunc func);
@@ -869,106 +1336,453 @@ private:
 }
 #endif
 
-#line 2 "src/test.impl"
+#line 2 "src/SegmentedVector.impl"
 #ifdef LISP_NAMESPACE
 namespace LISP_NAMESPACE {
 #endif
 
-#define LISP_TEST_FILE stdout
+#define LISP_SEGMENT_SIZE (UINT64_C(1) << LISP_SEGMENT_BITS)
+#define LISP_SEGMENT_MASK (LISP_SEGMENT_SIZE - UINT64_C(1))
 
-void test_begin(TestState * test)
-{
-    test->num_tests    = 0;
-    test->num_failed   = 0;
-    test->show_pass    = true;
-    test->exit_on_fail = false;
-}
+/* grows one fixed-size segment at a time, so elements never move and
+   growing never copies more than the segment table */
 
-void test_finish(TestState * test)
+template <typename Value>
+class SegmentedVector
 {
-    if (test->num_failed)
-    {
-        fprintf(LISP_TEST_FILE, LISP_RED "FAIL" LISP_RESET " " "%d/%d test(s)\n", test->num_failed, test->num_tests);
-    }
-    else
+public:
+    SegmentedVector() : m_size(0)
     {
-        fprintf(LISP_TEST_FILE, LISP_GREEN "PASS" LISP_RESET " " "%d/%d test(s)\n", test->num_tests, test->num_tests);
     }
-}
-
-void test_group(TestState *, char const * text)
-{
-    fprintf(LISP_TEST_FILE, "==== %s ====\n", text);
-}
 
-void test_assert_try(TestState * test, bool exp, char const * msg)
-{
-    ++test->num_tests;
-    if (exp)
+    ~SegmentedVector()
     {
-        if (test->show_pass)
+        for (auto segment : m_segments)
         {
-            fprintf(LISP_TEST_FILE, LISP_GREEN "PASS" LISP_RESET " %s\n", msg);
+            for (U64 index = 0; index < LISP_SEGMENT_SIZE; ++index)
+            {
+                segment[index].~Value();
+            }
+            free_segment(segment);
         }
     }
-    else
+
+    void push_back(Value const & value)
     {
-        ++test->num_failed;
-        fprintf(LISP_TEST_FILE, LISP_RED "FAIL" LISP_RESET " %s\n", msg);
-        if (test->exit_on_fail)
+        if (m_size == capacity())
         {
-            exit(1);
+            m_segments.push_back(make_segment());
         }
+        (*this)[m_size++] = value;
     }
-}
 
-#ifdef LISP_NAMESPACE
-}
-#endif
+    void pop_back()
+    {
+        LISP_ASSERT_DEBUG(m_size > 0);
+        --m_size;
+    }
 
-#line 2 "src/error.impl"
-#ifdef LISP_NAMESPACE
-namespace LISP_NAMESPACE {
-#endif
+    Value & back()
+    {
+        LISP_ASSERT_DEBUG(m_size > 0);
+        return (*this)[m_size - 1];
+    }
 
-class PrintAndExit : public ErrorHandler
-{
-public:
-    PrintAndExit(FILE * file, int code) : m_file(file), m_code(code)
+    Value & operator[](U64 index)
     {
+        LISP_ASSERT_DEBUG(index < m_size);
+        return m_segments[index >> LISP_SEGMENT_BITS][index & LISP_SEGMENT_MASK];
     }
 
-    void vfail(char const * fmt, va_list ap)
+    Value const & operator[](U64 index) const
     {
-        fprintf(m_file, LISP_RED "[FAIL] " LISP_RESET);
-        vfprintf(m_file, fmt, ap);
-#if LISP_DEBUG_USE_SIGNAL
-        raise(SIGINT);
-#endif
-        exit(m_code);
+        LISP_ASSERT_DEBUG(index < m_size);
+        return m_segments[index >> LISP_SEGMENT_BITS][index & LISP_SEGMENT_MASK];
     }
 
-    void vwarn(char const * fmt, va_list ap)
+    U64 size() const
     {
-        fprintf(m_file, LISP_YELLOW "[WARN] " LISP_RESET);
-        vfprintf(m_file, fmt, ap);
+        return m_size;
     }
 
-private:
-    FILE * m_file;
-    int m_code;
-};
+    bool empty() const
+    {
+        return m_size == 0;
+    }
 
-class ErrorSystem
-{
-public:
-    ErrorSystem() : m_default(stderr, 1)
+    /* keeps the segments around for reuse */
+    void clear()
     {
+        m_size = 0;
     }
 
-    void vfail(char const * fmt, va_list ap)
+protected:
+    U64 capacity() const
     {
-        if (m_handlers.empty())
+        return (U64) m_segments.size() << LISP_SEGMENT_BITS;
+    }
+
+    Value * make_segment()
+    {
+        size_t const size = sizeof(Value) * LISP_SEGMENT_SIZE;
+#if LISP_SEGMENT_HUGEPAGES
+        void * mem = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (mem == MAP_FAILED)
+        {
+            mem = NULL;
+        }
+#ifdef MADV_HUGEPAGE
+        else
+        {
+            madvise(mem, size, MADV_HUGEPAGE);
+        }
+#endif
+#else
+        void * mem = LISP_MALLOC(size);
+#endif
+        if (!mem)
+        {
+            LISP_FAIL("cannot allocate segment of %" PRIu64 " bytes\n", (U64) size);
+        }
+        Value * segment = (Value *) mem;
+        for (U64 index = 0; index < LISP_SEGMENT_SIZE; ++index)
+        {
+            new (segment + index) Value;
+        }
+        return segment;
+    }
+
+    void free_segment(Value * segment)
+    {
+#if LISP_SEGMENT_HUGEPAGES
+        munmap(segment, sizeof(Value) * LISP_SEGMENT_SIZE);
+#else
+        LISP_FREE(segment);
+#endif
+    }
+
+private:
+    SegmentedVector(SegmentedVector const &);
+    SegmentedVector & operator=(SegmentedVector const &);
+
+    std::vector<Value *> m_segments;
+    U64 m_size;
+};
+
+#ifdef LISP_NAMESPACE
+}
+#endif
+
+#line 2 "src/Pool.impl"
+#ifdef LISP_NAMESPACE
+namespace LISP_NAMESPACE {
+#endif
+
+#define LISP_POOL_LIVE       UINT8_C(0x01)
+#define LISP_POOL_MARK       UINT8_C(0x02)
+#define LISP_POOL_OLD        UINT8_C(0x04)
+#define LISP_POOL_REMEMBERED UINT8_C(0x08)
+
+/* index-based storage with a free list, shared by all heap stores,
+   backed by segments so that growing the heap never moves a value
+
+   a generational pool logs the slots it hands out, so that a minor
+   collection only has to look at those plus the old slots written to
+   since (the remembered set), survivors are promoted in place as
+   exprs are plain indices and cannot be forwarded */
+
+template <typename Value>
+class Pool
+{
+public:
+    Pool(bool generational = false) : m_generational(generational), m_live(0), m_made(0)
+    {
+    }
+
+    U64 make(Value const & value)
+    {
+        U64 index;
+        if (m_free.empty())
+        {
+            index = count();
+            m_values.push_back(value);
+            m_flags.push_back(LISP_POOL_LIVE);
+        }
+        else
+        {
+            index = m_free.back();
+            m_free.pop_back();
+            m_values[index] = value;
+            m_flags[index] = LISP_POOL_LIVE;
+        }
+        if (m_generational)
+        {
+            m_young.push_back(index);
+        }
+        ++m_live;
+        ++m_made;
+        return index;
+    }
+
+    void release(U64 index)
+    {
+        LISP_ASSERT(is_live(index));
+        m_values[index] = Value();
+        m_flags[index] = 0;
+        m_free.push_back(index);
+        --m_live;
+    }
+
+    Value & operator[](U64 index)
+    {
+        LISP_ASSERT_DEBUG(is_live(index));
+        return m_values[index];
+    }
+
+    bool is_live(U64 index) const
+    {
+        return index < count() && (m_flags[index] & LISP_POOL_LIVE);
+    }
+
+    bool is_marked(U64 index) const
+    {
+        return is_live(index) && (m_flags[index] & LISP_POOL_MARK);
+    }
+
+    bool mark(U64 index, bool young_only = false)
+    {
+        LISP_ASSERT_DEBUG(is_live(index));
+        U8 const flags = m_flags[index];
+        if (flags & LISP_POOL_MARK)
+        {
+            return false;
+        }
+        if (young_only && (flags & LISP_POOL_OLD))
+        {
+            return false;
+        }
+        m_flags[index] = flags | LISP_POOL_MARK;
+        return true;
+    }
+
+    /* write barrier */
+    void remember(U64 index)
+    {
+        U8 const flags = m_flags[index];
+        if ((flags & (LISP_POOL_OLD | LISP_POOL_REMEMBERED)) == LISP_POOL_OLD)
+        {
+            m_flags[index] = flags | LISP_POOL_REMEMBERED;
+            m_remembered.push_back(index);
+        }
+    }
+
+    SegmentedVector<U64> const & remembered() const
+    {
+        return m_remembered;
+    }
+
+    U64 sweep()
+    {
+        U64 freed = 0;
+        for (U64 index = 0; index < count(); ++index)
+        {
+            U8 const flags = m_flags[index];
+            if (flags & LISP_POOL_MARK)
+            {
+                m_flags[index] = promote(flags);
+            }
+            else if (flags & LISP_POOL_LIVE)
+            {
+                release(index);
+                ++freed;
+            }
+        }
+        m_young.clear();
+        forget();
+        return freed;
+    }
+
+    U64 sweep_young()
+    {
+        U64 freed = 0;
+        for (U64 i = 0; i < m_young.size(); ++i)
+        {
+            U64 const index = m_young[i];
+            U8 const flags = m_flags[index];
+            if (flags & LISP_POOL_MARK)
+            {
+                m_flags[index] = promote(flags);
+            }
+            else if (flags & LISP_POOL_LIVE)
+            {
+                release(index);
+                ++freed;
+            }
+        }
+        m_young.clear();
+        forget();
+        return freed;
+    }
+
+    U64 count() const
+    {
+        return (U64) m_values.size();
+    }
+
+    U64 live() const
+    {
+        return m_live;
+    }
+
+    U64 made() const
+    {
+        return m_made;
+    }
+
+    U64 young() const
+    {
+        return (U64) m_young.size();
+    }
+
+protected:
+    U8 promote(U8 flags) const
+    {
+        flags &= ~LISP_POOL_MARK;
+        return m_generational ? flags | LISP_POOL_OLD : flags;
+    }
+
+    void forget()
+    {
+        for (U64 i = 0; i < m_remembered.size(); ++i)
+        {
+            m_flags[m_remembered[i]] &= ~LISP_POOL_REMEMBERED;
+        }
+        m_remembered.clear();
+    }
+
+private:
+    bool m_generational;
+    SegmentedVector<Value> m_values;
+    SegmentedVector<U8> m_flags;
+    SegmentedVector<U64> m_free;
+    SegmentedVector<U64> m_young;
+    SegmentedVector<U64> m_remembered;
+    U64 m_live;
+    U64 m_made;
+};
+
+#ifdef LISP_NAMESPACE
+}
+#endif
+
+#line 2 "src/test.impl"
+#ifdef LISP_NAMESPACE
+namespace LISP_NAMESPACE {
+#endif
+
+#define LISP_TEST_FILE stdout
+
+void test_begin(TestState * test)
+{
+    test->num_tests    = 0;
+    test->num_failed   = 0;
+    test->show_pass    = true;
+    test->exit_on_fail = false;
+}
+
+void test_finish(TestState * test)
+{
+    if (test->num_failed)
+    {
+        fprintf(LISP_TEST_FILE, LISP_RED "FAIL" LISP_RESET " " "%d/%d test(s)\n", test->num_failed, test->num_tests);
+    }
+    else
+    {
+        fprintf(LISP_TEST_FILE, LISP_GREEN "PASS" LISP_RESET " " "%d/%d test(s)\n", test->num_tests, test->num_tests);
+    }
+}
+
+void test_group(TestState *, char const * text)
+{
+    fprintf(LISP_TEST_FILE, "==== %s ====\n", text);
+}
+
+void test_assert_try(TestState * test, bool exp, char const * msg)
+{
+#if LISP_WANT_GLOBAL_API
+    /* keep what the test printed ahead of its verdict */
+    stream_flush(stream_get_stdout());
+#endif
+    ++test->num_tests;
+    if (exp)
+    {
+        if (test->show_pass)
+        {
+            fprintf(LISP_TEST_FILE, LISP_GREEN "PASS" LISP_RESET " %s\n", msg);
+        }
+    }
+    else
+    {
+        ++test->num_failed;
+        fprintf(LISP_TEST_FILE, LISP_RED "FAIL" LISP_RESET " %s\n", msg);
+        if (test->exit_on_fail)
+        {
+            exit(1);
+        }
+    }
+}
+
+#ifdef LISP_NAMESPACE
+}
+#endif
+
+#line 2 "src/error.impl"
+#ifdef LISP_NAMESPACE
+namespace LISP_NAMESPACE {
+#endif
+
+class PrintAndExit : public ErrorHandler
+{
+public:
+    PrintAndExit(FILE * file, int code) : m_file(file), m_code(code)
+    {
+    }
+
+    void vfail(char const * fmt, va_list ap)
+    {
+#if LISP_WANT_GLOBAL_API
+        /* the signal below skips exit handlers */
+        stream_flush(stream_get_stdout());
+#endif
+        fprintf(m_file, LISP_RED "[FAIL] " LISP_RESET);
+        vfprintf(m_file, fmt, ap);
+#if LISP_DEBUG_USE_SIGNAL
+        raise(SIGINT);
+#endif
+        exit(m_code);
+    }
+
+    void vwarn(char const * fmt, va_list ap)
+    {
+        fprintf(m_file, LISP_YELLOW "[WARN] " LISP_RESET);
+        vfprintf(m_file, fmt, ap);
+    }
+
+private:
+    FILE * m_file;
+    int m_code;
+};
+
+class ErrorSystem
+{
+public:
+    ErrorSystem() : m_default(stderr, 1)
+    {
+    }
+
+    void vfail(char const * fmt, va_list ap)
+    {
+        if (m_handlers.empty())
         {
             m_default.vfail(fmt, ap);
         }
@@ -1145,6 +1959,11 @@ public:
         LISP_ASSERT_ALWAYS(TYPE_BUILTIN_SPECIAL == make_type("builtin-special"));
         LISP_ASSERT_ALWAYS(TYPE_BUILTIN_FUNCTION == make_type("builtin-function"));
         LISP_ASSERT_ALWAYS(TYPE_BUILTIN_SYMBOL == make_type("builtin-symbol"));
+        LISP_ASSERT_ALWAYS(TYPE_CLOSURE_FUN == make_type("closure-function"));
+        LISP_ASSERT_ALWAYS(TYPE_CLOSURE_MAC == make_type("closure-macro"));
+        LISP_ASSERT_ALWAYS(TYPE_FRAME == make_type("frame"));
+        LISP_ASSERT_ALWAYS(TYPE_LOCAL_REF == make_type("local-ref"));
+        LISP_ASSERT_ALWAYS(TYPE_GLOBAL_REF == make_type("global-ref"));
     }
 
     U64 make(char const * name)
@@ -1342,11 +2161,35 @@ U32 char_code(Expr exp)
 namespace LISP_NAMESPACE {
 #endif
 
+/* names live in an arena of chunks that are never moved or freed, the
+   index is an open addressing table of symbol indices keyed by hash */
+
+struct SymbolInfo
+{
+    char const * name;
+    U64 size;
+    U64 hash;
+};
+
 class SymbolImpl
 {
 public:
-    SymbolImpl(U64 type) : m_type(type)
+    SymbolImpl(U64 type, char const * const * names = NULL, U64 count = 0) :
+        m_type(type), m_chunk(NULL), m_chunk_left(0)
+    {
+        m_index.resize(LISP_SYMBOL_INDEX_SIZE, 0);
+        for (U64 index = 0; index < count; ++index)
+        {
+            make(names[index]);
+        }
+    }
+
+    ~SymbolImpl()
     {
+        for (auto chunk : m_chunks)
+        {
+            LISP_FREE(chunk);
+        }
     }
 
     inline bool isinstance(Expr exp) const
@@ -1357,24 +2200,45 @@ public:
     Expr make(char const * name)
     {
         LISP_ASSERT_DEBUG(name);
+        U64 const size = (U64) strlen(name);
+        U64 const hash = hash_name(name, size);
 
-        // TODO check hash set of names first
-        for (U64 index = 0; index < count(); ++index)
+        U64 const mask = (U64) m_index.size() - 1;
+        for (U64 slot = hash & mask;; slot = (slot + 1) & mask)
         {
-            if (m_names[index] == name)
+            U64 const entry = m_index[slot];
+            if (!entry)
+            {
+                break;
+            }
+            SymbolInfo const & info = m_info[entry - 1];
+            if (info.hash == hash && info.size == size && !memcmp(info.name, name, size))
             {
-                return make_expr(m_type, index);
+                return make_expr(m_type, entry - 1);
             }
         }
 
-        U64 const index = count();
-        m_names.push_back(name);
-        return make_expr(m_type, index);
-    }
+        SymbolInfo info;
+        info.name = store(name, size);
+        info.size = size;
+        info.hash = hash;
 
-    char const * name(Expr exp)
-    {
-    #if LISP_SYMBOL_NAME_OF_NIL
+        U64 const index = count();
+        m_info.push_back(info);
+        if (2 * count() > (U64) m_index.size())
+        {
+            rehash();
+        }
+        else
+        {
+            insert(index);
+        }
+        return make_expr(m_type, index);
+    }
+
+    char const * name(Expr exp)
+    {
+    #if LISP_SYMBOL_NAME_OF_NIL
         if (exp == nil)
         {
             return "nil";
@@ -1387,23 +2251,83 @@ public:
         {
             LISP_FAIL("illegal symbol index %" PRIu64 "\n", index);
         }
-        return m_names[index].c_str();
+        return m_info[index].name;
     }
 
 protected:
     U64 count() const
     {
-        return (U64) m_names.size();
+        return (U64) m_info.size();
+    }
+
+    static U64 hash_name(char const * name, U64 size)
+    {
+        /* FNV-1a */
+        U64 hash = UINT64_C(14695981039346656037);
+        for (U64 i = 0; i < size; ++i)
+        {
+            hash ^= (U8) name[i];
+            hash *= UINT64_C(1099511628211);
+        }
+        return hash;
+    }
+
+    char const * store(char const * name, U64 size)
+    {
+        if (size + 1 > m_chunk_left)
+        {
+            U64 const chunk_size = size + 1 > LISP_SYMBOL_CHUNK_SIZE ? size + 1 : LISP_SYMBOL_CHUNK_SIZE;
+            m_chunk = (char *) LISP_MALLOC(chunk_size);
+            if (!m_chunk)
+            {
+                LISP_FAIL("cannot allocate symbol chunk of %" PRIu64 " bytes\n", chunk_size);
+            }
+            m_chunks.push_back(m_chunk);
+            m_chunk_left = chunk_size;
+        }
+        char * dst = m_chunk;
+        memcpy(dst, name, size);
+        dst[size] = 0;
+        m_chunk += size + 1;
+        m_chunk_left -= size + 1;
+        return dst;
+    }
+
+    void insert(U64 index)
+    {
+        U64 const mask = (U64) m_index.size() - 1;
+        U64 slot = m_info[index].hash & mask;
+        while (m_index[slot])
+        {
+            slot = (slot + 1) & mask;
+        }
+        m_index[slot] = index + 1;
+    }
+
+    void rehash()
+    {
+        U64 const size = 2 * (U64) m_index.size();
+        m_index.assign(size, 0);
+        for (U64 index = 0; index < count(); ++index)
+        {
+            insert(index);
+        }
     }
 
 private:
     U64 m_type;
-    std::vector<std::string> m_names;
+    SegmentedVector<SymbolInfo> m_info;
+    std::vector<U64> m_index;
+    std::vector<char *> m_chunks;
+    char * m_chunk;
+    U64 m_chunk_left;
 };
 
 #if LISP_WANT_GLOBAL_API
 
-static SymbolImpl g_symbol(TYPE_SYMBOL);
+static char const * const g_symbol_names[SYMBOL_COUNT] = { LISP_SYMBOL_NAMES };
+
+static SymbolImpl g_symbol(TYPE_SYMBOL, g_symbol_names, SYMBOL_COUNT);
 
 Expr make_symbol(char const * name)
 {
@@ -1459,7 +2383,7 @@ struct ExprPair
 class ConsImpl
 {
 public:
-    ConsImpl(U64 type) : m_type(type)
+    ConsImpl(U64 type) : m_type(type), m_pairs(LISP_GC_GENERATIONAL)
     {
     }
 
@@ -1470,11 +2394,10 @@ public:
 
     Expr make(Expr a, Expr b)
     {
-        U64 const index = count();
         ExprPair pair;
         pair.exp1 = a;
         pair.exp2 = b;
-        m_pairs.push_back(pair);
+        U64 const index = m_pairs.make(pair);
         return make_expr(m_type, index);
     }
 
@@ -1482,7 +2405,7 @@ public:
     {
         LISP_ASSERT(isinstance(exp));
         Expr const index = expr_data(exp);
-        LISP_ASSERT(index < count());
+        LISP_ASSERT(m_pairs.is_live(index));
         return m_pairs[index].exp1;
     }
 
@@ -1490,7 +2413,7 @@ public:
     {
         LISP_ASSERT(isinstance(exp));
         Expr const index = expr_data(exp);
-        LISP_ASSERT(index < count());
+        LISP_ASSERT(m_pairs.is_live(index));
         return m_pairs[index].exp2;
     }
 
@@ -1498,7 +2421,8 @@ public:
     {
         LISP_ASSERT(isinstance(exp));
         Expr const index = expr_data(exp);
-        LISP_ASSERT(index < count());
+        LISP_ASSERT(m_pairs.is_live(index));
+        m_pairs.remember(index);
         m_pairs[index].exp1 = val;
     }
 
@@ -1506,19 +2430,56 @@ public:
     {
         LISP_ASSERT(isinstance(exp));
         Expr const index = expr_data(exp);
-        LISP_ASSERT(index < count());
+        LISP_ASSERT(m_pairs.is_live(index));
+        m_pairs.remember(index);
         m_pairs[index].exp2 = val;
     }
 
-protected:
-    U64 count() const
+    bool is_marked(Expr exp) const
+    {
+        LISP_ASSERT(isinstance(exp));
+        return m_pairs.is_marked(expr_data(exp));
+    }
+
+    bool mark(Expr exp, bool young_only)
+    {
+        LISP_ASSERT(isinstance(exp));
+        return m_pairs.mark(expr_data(exp), young_only);
+    }
+
+    U64 sweep()
+    {
+        return m_pairs.sweep();
+    }
+
+    U64 sweep_young()
+    {
+        return m_pairs.sweep_young();
+    }
+
+    template <typename Func>
+    void each_remembered(Func func)
+    {
+        auto const & remembered = m_pairs.remembered();
+        for (U64 i = 0; i < remembered.size(); ++i)
+        {
+            func(make_expr(m_type, remembered[i]));
+        }
+    }
+
+    U64 live() const
+    {
+        return m_pairs.live();
+    }
+
+    U64 made() const
     {
-        return (U64) m_pairs.size();
+        return m_pairs.made();
     }
 
 private:
     U64 m_type;
-    std::vector<ExprPair> m_pairs;
+    Pool<ExprPair> m_pairs;
 };
 
 template <typename T>
@@ -1641,7 +2602,7 @@ namespace LISP_NAMESPACE {
 class StringImpl
 {
 public:
-    StringImpl(U64 type) : m_type(type)
+    StringImpl(U64 type) : m_type(type), m_strings(LISP_GC_GENERATIONAL)
     {
     }
 
@@ -1652,8 +2613,13 @@ public:
 
     Expr make(char const * str)
     {
-        U64 const index = count();
-        m_strings.push_back(str);
+        U64 const index = m_strings.make(str);
+        return make_expr(m_type, index);
+    }
+
+    Expr make_bytes(char const * data, U64 size)
+    {
+        U64 const index = m_strings.make(std::string(data, size));
         return make_expr(m_type, index);
     }
 
@@ -1662,6 +2628,11 @@ public:
         return impl(exp).c_str();
     }
 
+    char const * data(Expr exp)
+    {
+        return impl(exp).data();
+    }
+
     U64 length(Expr exp)
     {
         return (U64) impl(exp).size();
@@ -1672,23 +2643,44 @@ public:
         return impl(exp1) == impl(exp2);
     }
 
-protected:
-    U64 count() const
+    bool mark(Expr exp, bool young_only)
+    {
+        LISP_ASSERT(isinstance(exp));
+        return m_strings.mark(expr_data(exp), young_only);
+    }
+
+    U64 sweep()
+    {
+        return m_strings.sweep();
+    }
+
+    U64 sweep_young()
+    {
+        return m_strings.sweep_young();
+    }
+
+    U64 live() const
     {
-        return (U64) m_strings.size();
+        return m_strings.live();
     }
 
+    U64 made() const
+    {
+        return m_strings.made();
+    }
+
+protected:
     std::string const & impl(Expr exp)
     {
         LISP_ASSERT(isinstance(exp));
         U64 const index = expr_data(exp);
-        LISP_ASSERT(index < count());
+        LISP_ASSERT(m_strings.is_live(index));
         return m_strings[index];
     }
 
 private:
     U64 m_type;
-    std::vector<std::string> m_strings;
+    Pool<std::string> m_strings;
 };
 
 #if LISP_WANT_GLOBAL_API
@@ -1700,6 +2692,11 @@ Expr make_string(char const * str)
     return g_string.make(str);
 }
 
+Expr make_string_bytes(char const * data, U64 size)
+{
+    return g_string.make_bytes(data, size);
+}
+
 Expr make_string_from_utf8(U8 const * str)
 {
     // TODO assert this works?
@@ -1758,6 +2755,11 @@ U8 const * string_value_utf8(Expr exp)
     return (U8 const *) string_value(exp);
 }
 
+char const * string_data(Expr exp)
+{
+    return g_string.data(exp);
+}
+
 U64 string_length(Expr exp)
 {
     return g_string.length(exp);
@@ -1787,23 +2789,27 @@ public:
         m_stdin = make_file_input(stdin, false);
         m_stdout = make_file_output(stdout, false);
         m_stderr = make_file_output(stderr, false);
+
+        /* same policy as stdio */
+        get_info(m_stdout).flush_mode = isatty(fileno(stdout)) ? STREAM_FLUSH_LINE : STREAM_FLUSH_FULL;
+        get_info(m_stderr).flush_mode = STREAM_FLUSH_ALWAYS;
     }
 
     ~StreamImpl()
     {
         // TODO add this to stream api?
-        for (auto & info : m_info)
+        for (U64 index = 0; index < m_info.count(); ++index)
         {
-            if (info.close_on_quit)
+            if (!m_info.is_live(index))
             {
-                if (info.file)
-                {
-                    fclose(info.file);
-                    info.file = NULL;
-                }
+                continue;
             }
+            close_info(m_info[index]);
+        }
+        for (U8 * block : m_blocks)
+        {
+            LISP_FREE(block);
         }
-        m_info.clear();
     }
 
     Expr get_stdin()
@@ -1828,7 +2834,23 @@ public:
 
     Expr make_file_output(FILE * file, bool close_on_quit)
     {
-        return make_file(file, close_on_quit);
+        Expr const exp = make_file(file, close_on_quit);
+        get_info(exp).output = true;
+        return exp;
+    }
+
+    Expr make_file_input_from_path(char const * path)
+    {
+#if LISP_STREAM_MMAP
+        Expr const exp = make_mapped_input(path);
+        if (exp)
+        {
+            return exp;
+        }
+#endif
+        FILE * file = fopen(path, "rb");
+        LISP_ASSERT(file);
+        return make_file_input(file, true);
     }
 
     Expr make_string_input(char const * str)
@@ -1843,22 +2865,45 @@ public:
         return make_buffer(size, buffer);
     }
 
-    U8 read_byte(Expr exp)
+    Expr make_string_output()
+    {
+        StreamInfo info;
+        memset(&info, 0, sizeof(StreamInfo));
+        info.text = new std::string();
+        return make_from_info(info);
+    }
+
+    char const * string_value(Expr exp)
     {
         StreamInfo & info = get_info(exp);
-        if (info.file)
+        LISP_ASSERT(info.text);
+        return info.text->c_str();
+    }
+
+    U8 read_byte(StreamInfo & info)
+    {
+        if (info.buffer)
         {
-            int ch = fgetc(info.file);
-            if (ch == EOF)
+            /* mapped files have no terminator */
+            if (info.cursor >= info.size)
             {
                 return 0;
             }
-            return (U8) ch;
+            return info.buffer[info.cursor++];
         }
 
-        if (info.buffer)
+        if (info.block_cursor < info.block_end)
         {
-            return info.buffer[info.cursor++];
+            return info.block[info.block_cursor++];
+        }
+
+        if (info.file)
+        {
+            if (!fill_block(info))
+            {
+                return 0;
+            }
+            return info.block[info.block_cursor++];
         }
 
         //LISP_FAIL("cannot read from stream %s\n", repr(exp));
@@ -1866,9 +2911,9 @@ public:
         return 0;
     }
 
-    U32 do_read_char(Expr exp)
+    U32 do_read_char(StreamInfo & info)
     {
-        U8 ch = read_byte(exp);
+        U8 ch = read_byte(info);
         if (ch & 0x80)
         {
             U32 val = 0;
@@ -1876,7 +2921,7 @@ public:
             {
                 val |= ch & 0x1f;
 
-                ch = read_byte(exp);
+                ch = read_byte(info);
                 val <<= 6;
                 val |= (ch & 0x3f);
             }
@@ -1884,11 +2929,11 @@ public:
             {
                 val |= ch & 0xf;
 
-                ch = read_byte(exp);
+                ch = read_byte(info);
                 val <<= 6;
                 val |= (ch & 0x3f);
 
-                ch = read_byte(exp);
+                ch = read_byte(info);
                 val <<= 6;
                 val |= (ch & 0x3f);
             }
@@ -1896,15 +2941,15 @@ public:
             {
                 val |= ch & 0x7;
 
-                ch = read_byte(exp);
+                ch = read_byte(info);
                 val <<= 6;
                 val |= (ch & 0x3f);
 
-                ch = read_byte(exp);
+                ch = read_byte(info);
                 val <<= 6;
                 val |= (ch & 0x3f);
 
-                ch = read_byte(exp);
+                ch = read_byte(info);
                 val <<= 6;
                 val |= (ch & 0x3f);
             }
@@ -1923,7 +2968,11 @@ public:
 
     U32 read_char(Expr exp)
     {
-        StreamInfo & info = get_info(exp);
+        return read_char(get_info(exp));
+    }
+
+    U32 read_char(StreamInfo & info)
+    {
         if (info.peek)
         {
             auto const ret = info.peek;
@@ -1931,7 +2980,7 @@ public:
             return ret;
         }
 
-        return do_read_char(exp);
+        return do_read_char(info);
     }
 
     U32 peek_char(Expr exp)
@@ -1939,7 +2988,8 @@ public:
         StreamInfo & info = get_info(exp);
         if (!info.peek)
         {
-            info.peek = read_char(exp);
+            info.peek_cursor = info.cursor;
+            info.peek = read_char(info);
         }
         return info.peek;
     }
@@ -1949,6 +2999,33 @@ public:
         read_char(exp);
     }
 
+    /* the unread bytes of a buffer stream, handing back a peeked char,
+       or NULL when the stream is not backed by memory */
+    U8 const * span(Expr exp, size_t * size)
+    {
+        StreamInfo & info = get_info(exp);
+        if (!info.buffer)
+        {
+            *size = 0;
+            return NULL;
+        }
+        if (info.peek)
+        {
+            info.cursor = info.peek_cursor;
+            info.peek = 0;
+        }
+        *size = info.cursor < info.size ? info.size - info.cursor : 0;
+        return (U8 const *) info.buffer + info.cursor;
+    }
+
+    void advance(Expr exp, size_t count)
+    {
+        StreamInfo & info = get_info(exp);
+        LISP_ASSERT(info.buffer && !info.peek);
+        LISP_ASSERT(info.cursor + count <= info.size);
+        info.cursor += count;
+    }
+
     bool at_end(Expr exp)
     {
         return peek_char(exp) == 0;
@@ -1997,7 +3074,29 @@ public:
         StreamInfo & info = get_info(exp);
         if (info.file)
         {
-            fwrite(bytes, size, 1, info.file);
+            if (info.block_cursor + size > LISP_STREAM_BLOCK_SIZE)
+            {
+                flush_block(info);
+                if (size >= LISP_STREAM_BLOCK_SIZE)
+                {
+                    write_all(info, bytes, size);
+                    return;
+                }
+            }
+            memcpy(info.block + info.block_cursor, bytes, size);
+            info.block_cursor += size;
+
+            if (info.flush_mode == STREAM_FLUSH_ALWAYS ||
+                (info.flush_mode == STREAM_FLUSH_LINE && memchr(bytes, '\n', size)))
+            {
+                flush_block(info);
+            }
+            return;
+        }
+
+        if (info.text)
+        {
+            info.text->append((char const *) bytes, size);
             return;
         }
 
@@ -2024,32 +3123,32 @@ public:
         put_bytes(exp, 1, &val);
     }
 
-    void release(Expr exp)
+    void flush(Expr exp)
     {
-        auto & info = get_info(exp);
-        if (info.close_on_quit)
+        StreamInfo & info = get_info(exp);
+        if (info.file && info.output)
         {
-            if (info.file)
-            {
-                fclose(info.file);
-                info.file = NULL;
-            }
+            flush_block(info);
         }
+    }
 
-        // TODO add to free list
+    void release(Expr exp)
+    {
+        close_info(get_info(exp));
+        m_info.release(expr_data(exp));
     }
 
-protected:
-    U64 count() const
+    U64 live() const
     {
-        return (U64) m_info.size();
+        return m_info.live();
     }
 
+protected:
     StreamInfo & get_info(Expr exp)
     {
         LISP_ASSERT(is_stream(exp));
         U64 const index = expr_data(exp);
-        LISP_ASSERT(index < count());
+        LISP_ASSERT(m_info.is_live(index));
         return m_info[index];
     }
 
@@ -2059,9 +3158,143 @@ protected:
         memset(&info, 0, sizeof(StreamInfo));
         info.file = file;
         info.close_on_quit = close_on_quit;
+        info.fd = fileno(file);
+        info.flush_mode = STREAM_FLUSH_FULL;
+        /* reuse blocks, a file per load would fragment the heap otherwise */
+        if (m_blocks.empty())
+        {
+            info.block = (U8 *) LISP_MALLOC(LISP_STREAM_BLOCK_SIZE);
+        }
+        else
+        {
+            info.block = m_blocks.back();
+            m_blocks.pop_back();
+        }
         return make_from_info(info);
     }
 
+    bool fill_block(StreamInfo & info)
+    {
+        info.block_cursor = 0;
+        info.block_end = 0;
+        if (info.eof)
+        {
+            return false;
+        }
+
+        for (;;)
+        {
+            ssize_t const got = read(info.fd, info.block, LISP_STREAM_BLOCK_SIZE);
+            if (got > 0)
+            {
+                info.block_end = (size_t) got;
+                return true;
+            }
+            if (got == 0)
+            {
+                info.eof = true;
+                return false;
+            }
+            if (errno != EINTR)
+            {
+                LISP_FAIL("cannot read from stream: %s\n", strerror(errno));
+                return false;
+            }
+        }
+    }
+
+    void flush_block(StreamInfo & info)
+    {
+        size_t const size = info.block_cursor;
+        if (size == 0)
+        {
+            return;
+        }
+        info.block_cursor = 0;
+        write_all(info, info.block, size);
+    }
+
+    void write_all(StreamInfo & info, U8 const * bytes, size_t size)
+    {
+        /* whatever went through stdio on the same file goes first */
+        fflush(info.file);
+        while (size > 0)
+        {
+            ssize_t const put = write(info.fd, bytes, size);
+            if (put < 0)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                LISP_FAIL("cannot write to stream: %s\n", strerror(errno));
+                return;
+            }
+            bytes += put;
+            size -= (size_t) put;
+        }
+    }
+
+#if LISP_STREAM_MMAP
+    /* nil for anything but a non-empty regular file, which the caller
+       then reads in blocks, like pipes and stdin */
+    Expr make_mapped_input(char const * path)
+    {
+        int const fd = open(path, O_RDONLY);
+        if (fd < 0)
+        {
+            return nil;
+        }
+
+        struct stat st;
+        void * data = MAP_FAILED;
+        if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0)
+        {
+            data = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        }
+        close(fd);
+        if (data == MAP_FAILED)
+        {
+            return nil;
+        }
+        madvise(data, (size_t) st.st_size, MADV_SEQUENTIAL);
+
+        Expr const exp = make_buffer((size_t) st.st_size, (char *) data);
+        get_info(exp).mapped = true;
+        return exp;
+    }
+#endif
+
+    void close_info(StreamInfo & info)
+    {
+        if (info.file && info.output)
+        {
+            flush_block(info);
+        }
+        if (info.close_on_quit)
+        {
+            if (info.file)
+            {
+                fclose(info.file);
+                info.file = NULL;
+            }
+        }
+        if (info.block)
+        {
+            m_blocks.push_back(info.block);
+            info.block = NULL;
+        }
+#if LISP_STREAM_MMAP
+        if (info.mapped)
+        {
+            munmap(info.buffer, info.size);
+            info.buffer = NULL;
+        }
+#endif
+        delete info.text;
+        info.text = NULL;
+    }
+
     Expr make_buffer(size_t size, char * buffer)
     {
         StreamInfo info;
@@ -2074,24 +3307,16 @@ protected:
 
     Expr make_from_info(StreamInfo const & info)
     {
-        U64 const index = count();
-        m_info.push_back(info);
+        U64 const index = m_info.make(info);
         return make_expr(TYPE_STREAM, index);
     }
 
-    StreamInfo & info(Expr exp)
-    {
-        LISP_ASSERT(is_stream(exp));
-        Expr const index = expr_data(exp);
-        LISP_ASSERT(index < count());
-        return m_info[index];
-    }
-
 private:
     Expr m_stdin;
     Expr m_stdout;
     Expr m_stderr;
-    std::vector<StreamInfo> m_info;
+    Pool<StreamInfo> m_info;
+    std::vector<U8 *> m_blocks;
 };
 
 #if LISP_WANT_GLOBAL_API
@@ -2100,9 +3325,14 @@ StreamImpl g_stream;
 
 Expr make_file_input_stream_from_path(char const * path)
 {
-    FILE * file = fopen(path, "rb");
+    return g_stream.make_file_input_from_path(path);
+}
+
+Expr make_file_output_stream_from_path(char const * path)
+{
+    FILE * file = fopen(path, "wb");
     LISP_ASSERT(file);
-    return g_stream.make_file_input(file, true);
+    return g_stream.make_file_output(file, true);
 }
 
 Expr make_string_input_stream(char const * str)
@@ -2115,12 +3345,22 @@ Expr make_buffer_output_stream(size_t size, char * str)
     return g_stream.make_buffer_output(size, str);
 }
 
-U32 stream_read_char(Expr exp)
+Expr make_string_output_stream()
 {
-    return g_stream.read_char(exp);
+    return g_stream.make_string_output();
 }
 
-U32 stream_peek_char(Expr exp)
+char const * stream_string_value(Expr exp)
+{
+    return g_stream.string_value(exp);
+}
+
+U32 stream_read_char(Expr exp)
+{
+    return g_stream.read_char(exp);
+}
+
+U32 stream_peek_char(Expr exp)
 {
     return g_stream.peek_char(exp);
 }
@@ -2130,6 +3370,21 @@ void stream_skip_char(Expr exp)
     g_stream.skip_char(exp);
 }
 
+U8 const * stream_span(Expr exp, size_t * size)
+{
+    return g_stream.span(exp, size);
+}
+
+void stream_advance(Expr exp, size_t count)
+{
+    g_stream.advance(exp, count);
+}
+
+void stream_put_bytes(Expr exp, size_t size, U8 const * bytes)
+{
+    g_stream.put_bytes(exp, size, bytes);
+}
+
 void stream_put_cchar(Expr exp, char ch)
 {
     g_stream.put_cchar(exp, ch);
@@ -2180,6 +3435,11 @@ void stream_put_pointer(Expr exp, void const * ptr)
     stream_put_cstring(exp, str);
 }
 
+void stream_flush(Expr exp)
+{
+    g_stream.flush(exp);
+}
+
 void stream_release(Expr exp)
 {
     g_stream.release(exp);
@@ -2273,7 +3533,7 @@ namespace LISP_NAMESPACE {
 class PointerImpl
 {
 public:
-    PointerImpl(U64 type) : m_type(type)
+    PointerImpl(U64 type) : m_type(type), m_values(LISP_GC_GENERATIONAL)
     {
     }
 
@@ -2284,8 +3544,7 @@ public:
 
     Expr make(void * ptr)
     {
-        U64 const index = count();
-        m_values.push_back(ptr);
+        U64 const index = m_values.make(ptr);
         return make_expr(m_type, index);
     }
 
@@ -2293,19 +3552,39 @@ public:
     {
         LISP_ASSERT(isinstance(exp));
         auto const index = expr_data(exp);
-        LISP_ASSERT(index < count());
+        LISP_ASSERT(m_values.is_live(index));
         return m_values[index];
     }
 
-protected:
-    U64 count() const
+    bool mark(Expr exp, bool young_only)
+    {
+        LISP_ASSERT(isinstance(exp));
+        return m_values.mark(expr_data(exp), young_only);
+    }
+
+    U64 sweep()
+    {
+        return m_values.sweep();
+    }
+
+    U64 sweep_young()
+    {
+        return m_values.sweep_young();
+    }
+
+    U64 live() const
+    {
+        return m_values.live();
+    }
+
+    U64 made() const
     {
-        return m_values.size();
+        return m_values.made();
     }
 
 private:
     U64 m_type;
-    std::vector<void *> m_values;
+    Pool<void *> m_values;
 };
 
 #if LISP_WANT_GLOBAL_API
@@ -2347,6 +3626,13 @@ public:
         return make(name, func, TYPE_BUILTIN_SPECIAL);
     }
 
+    Expr make_special_kind(char const * name, U64 kind, BuiltinFunc func)
+    {
+        Expr const ret = make(name, func, TYPE_BUILTIN_SPECIAL);
+        info(ret).kind = kind;
+        return ret;
+    }
+
     Expr make_function(char const * name, BuiltinFunc func)
     {
         return make(name, func, TYPE_BUILTIN_FUNCTION);
@@ -2357,42 +3643,178 @@ public:
         return make(name, func, TYPE_BUILTIN_SYMBOL);
     }
 
+    Expr make_function1(char const * name, BuiltinFunc1 func)
+    {
+        BuiltinInfo info = make_info(name, BUILTIN_ARITY_1);
+        info.func1 = func;
+        return make_expr(TYPE_BUILTIN_FUNCTION, m_info.make(info));
+    }
+
+    Expr make_function2(char const * name, BuiltinFunc2 func)
+    {
+        BuiltinInfo info = make_info(name, BUILTIN_ARITY_2);
+        info.func2 = func;
+        return make_expr(TYPE_BUILTIN_FUNCTION, m_info.make(info));
+    }
+
+    Expr make_function3(char const * name, BuiltinFunc3 func)
+    {
+        BuiltinInfo info = make_info(name, BUILTIN_ARITY_3);
+        info.func3 = func;
+        return make_expr(TYPE_BUILTIN_FUNCTION, m_info.make(info));
+    }
+
+    Expr make_function_args(char const * name, BuiltinFuncArgs func)
+    {
+        BuiltinInfo info = make_info(name, BUILTIN_ARGS);
+        info.funcv = func;
+        return make_expr(TYPE_BUILTIN_FUNCTION, m_info.make(info));
+    }
+
+    Expr make_function_data(char const * name, U64 arity, BuiltinFuncData func, std::shared_ptr<void> data)
+    {
+        BuiltinInfo info = make_info(name, BUILTIN_DATA);
+        info.funcd = func;
+        info.data = std::move(data);
+        info.arity = arity;
+        return make_expr(TYPE_BUILTIN_FUNCTION, m_info.make(info));
+    }
+
     char const * name(Expr exp)
     {
         return info(exp).name;
     }
 
-    BuiltinFunc func(Expr exp)
+    U64 special_kind(Expr exp)
     {
-        return info(exp).func;
+        LISP_ASSERT_DEBUG(is_builtin_special(exp));
+        return m_info[expr_data(exp)].kind;
     }
 
-protected:
-    U64 count() const
+    /* the pool never moves its values, so the reference stays good */
+    BuiltinFunc const & func(Expr exp)
     {
-        return (U64) m_info.size();
+        BuiltinInfo const & ret = info(exp);
+        LISP_ASSERT(ret.conv == BUILTIN_LIST);
+        return ret.func;
+    }
+
+    /* calls with the args on the value stack of the caller, only a
+       builtin that wants a list gets one made */
+    Expr call(Expr exp, Expr const * args, U64 argc, Expr env)
+    {
+        BuiltinInfo const & info = this->info(exp);
+        if (info.conv != BUILTIN_LIST)
+        {
+            return call_stack(info, args, argc);
+        }
+        Expr vals = nil;
+        for (U64 i = argc; i > 0; --i)
+        {
+            vals = cons(args[i - 1], vals);
+        }
+        GcRoot const vals_root(vals);
+        return info.func(vals, env);
+    }
+
+    /* calls with the args in a list, for apply and friends */
+    Expr apply(Expr exp, Expr vals, Expr env)
+    {
+        BuiltinInfo const & info = this->info(exp);
+        switch (info.conv)
+        {
+        case BUILTIN_LIST:
+            return info.func(vals, env);
+        case BUILTIN_ARGS:
+        case BUILTIN_DATA:
+        {
+            /* leaf builtins do not come back here while they run, typed
+               ones are done with their args before they call the host */
+            m_args.clear();
+            for (Expr tmp = vals; tmp; tmp = cdr(tmp))
+            {
+                m_args.push_back(car(tmp));
+            }
+            return call_stack(info, m_args.data(), m_args.size());
+        }
+        default:
+        {
+            Expr args[LISP_BUILTIN_MAX_ARITY + 1];
+            U64 argc = 0;
+            for (Expr tmp = vals; tmp && argc <= LISP_BUILTIN_MAX_ARITY; tmp = cdr(tmp))
+            {
+                args[argc++] = car(tmp);
+            }
+            return call_stack(info, args, argc);
+        }
+        }
     }
 
+protected:
     Expr make(char const * name, BuiltinFunc func, U64 type)
     {
-        U64 const index = count();
-        BuiltinInfo info;
-        info.name = name; /* TODO take ownership of name? */
+        BuiltinInfo info = make_info(name, BUILTIN_LIST);
         info.func = func;
-        m_info.push_back(info);
+        U64 const index = m_info.make(info);
         return make_expr(type, index);
     }
 
+    BuiltinInfo make_info(char const * name, U64 conv)
+    {
+        BuiltinInfo info;
+        info.name = name; /* TODO take ownership of name? */
+        info.conv = conv;
+        info.kind = SPECIAL_OTHER;
+        info.func1 = nullptr;
+        info.func2 = nullptr;
+        info.func3 = nullptr;
+        info.funcv = nullptr;
+        info.funcd = nullptr;
+        info.arity = 0;
+        return info;
+    }
+
+    Expr call_stack(BuiltinInfo const & info, Expr const * args, U64 argc)
+    {
+        switch (info.conv)
+        {
+        case BUILTIN_ARITY_1:
+            check_arity(info, argc, 1);
+            return info.func1(args[0]);
+        case BUILTIN_ARITY_2:
+            check_arity(info, argc, 2);
+            return info.func2(args[0], args[1]);
+        case BUILTIN_ARITY_3:
+            check_arity(info, argc, 3);
+            return info.func3(args[0], args[1], args[2]);
+        case BUILTIN_DATA:
+            check_arity(info, argc, info.arity);
+            return info.funcd(info.data.get(), args);
+        default:
+            LISP_ASSERT(info.conv == BUILTIN_ARGS);
+            return info.funcv(args, argc);
+        }
+    }
+
+    void check_arity(BuiltinInfo const & info, U64 argc, U64 arity)
+    {
+        if (argc != arity)
+        {
+            LISP_FAIL("%s expects %" PRIu64 " argument(s), got %" PRIu64 "\n", info.name, arity, argc);
+        }
+    }
+
     BuiltinInfo & info(Expr exp)
     {
         LISP_ASSERT(is_builtin(exp));
         U64 const index = expr_data(exp);
-        LISP_ASSERT(index < count());
+        LISP_ASSERT(m_info.is_live(index));
         return m_info[index];
     }
 
 private:
-    std::vector<BuiltinInfo> m_info;
+    Pool<BuiltinInfo> m_info;
+    std::vector<Expr> m_args;
 };
 
 #if LISP_WANT_GLOBAL_API
@@ -2404,6 +3826,11 @@ Expr make_builtin_special(char const * name, BuiltinFunc func)
     return g_builtin.make_special(name, func);
 }
 
+Expr make_builtin_special_kind(char const * name, U64 kind, BuiltinFunc func)
+{
+    return g_builtin.make_special_kind(name, kind, func);
+}
+
 Expr make_builtin_function(char const * name, BuiltinFunc func)
 {
     return g_builtin.make_function(name, func);
@@ -2414,16 +3841,56 @@ Expr make_builtin_symbol(char const * name, BuiltinFunc func)
     return g_builtin.make_symbol(name, func);
 }
 
+Expr make_builtin_function1(char const * name, BuiltinFunc1 func)
+{
+    return g_builtin.make_function1(name, func);
+}
+
+Expr make_builtin_function2(char const * name, BuiltinFunc2 func)
+{
+    return g_builtin.make_function2(name, func);
+}
+
+Expr make_builtin_function3(char const * name, BuiltinFunc3 func)
+{
+    return g_builtin.make_function3(name, func);
+}
+
+Expr make_builtin_function_args(char const * name, BuiltinFuncArgs func)
+{
+    return g_builtin.make_function_args(name, func);
+}
+
+Expr make_builtin_function_data(char const * name, U64 arity, BuiltinFuncData func, std::shared_ptr<void> data)
+{
+    return g_builtin.make_function_data(name, arity, func, std::move(data));
+}
+
 char const * builtin_name(Expr exp)
 {
     return g_builtin.name(exp);
 }
 
-BuiltinFunc builtin_func(Expr exp)
+U64 builtin_special_kind(Expr exp)
+{
+    return g_builtin.special_kind(exp);
+}
+
+BuiltinFunc const & builtin_func(Expr exp)
 {
     return g_builtin.func(exp);
 }
 
+Expr builtin_call(Expr exp, Expr const * args, U64 argc, Expr env)
+{
+    return g_builtin.call(exp, args, argc, env);
+}
+
+Expr builtin_apply(Expr exp, Expr vals, Expr env)
+{
+    return g_builtin.apply(exp, vals, env);
+}
+
 #endif
 
 #ifdef LISP_NAMESPACE
@@ -2437,7 +3904,7 @@ namespace LISP_NAMESPACE {
 
 bool is_number(Expr exp)
 {
-    return is_fixnum(exp);
+    return is_fixnum(exp) || is_float(exp);
 }
 
 Expr make_number(I64 value)
@@ -2445,27 +3912,65 @@ Expr make_number(I64 value)
     return make_fixnum(value);
 }
 
+/* promotes fixnums to float for mixed arithmetic */
+static F32 number_float_value(Expr exp)
+{
+    return is_fixnum(exp) ? (F32) fixnum_value(exp) : float_value(exp);
+}
+
+static void number_check(Expr a, Expr b, char const * op)
+{
+    if (!is_number(a) || !is_number(b))
+    {
+        LISP_FAIL("cannot %s %s and %s\n", op, repr(a), repr(b));
+    }
+}
+
 Expr number_neg(Expr a)
 {
-    return fixnum_neg(a);
+    if (is_fixnum(a))
+    {
+        return fixnum_neg(a);
+    }
+    if (is_float(a))
+    {
+        return float_neg(a);
+    }
+    LISP_FAIL("cannot negate %s\n", repr(a));
+    return nil;
 }
 
 Expr number_add(Expr a, Expr b)
 {
-    return fixnum_add(a, b);
+    if (is_fixnum(a) && is_fixnum(b))
+    {
+        return fixnum_add(a, b);
+    }
+    number_check(a, b, "add");
+    return make_float(number_float_value(a) + number_float_value(b));
 }
 
 Expr number_sub(Expr a, Expr b)
 {
-    return fixnum_sub(a, b);
+    if (is_fixnum(a) && is_fixnum(b))
+    {
+        return fixnum_sub(a, b);
+    }
+    number_check(a, b, "subtract");
+    return make_float(number_float_value(a) - number_float_value(b));
 }
 
 Expr number_mul(Expr a, Expr b)
 {
-    return fixnum_mul(a, b);
+    if (is_fixnum(a) && is_fixnum(b))
+    {
+        return fixnum_mul(a, b);
+    }
+    number_check(a, b, "multiply");
+    return make_float(number_float_value(a) * number_float_value(b));
 }
 
-#define PACK_TYPE(a, b) ((a) | ((a) << LISP_TYPE_BITS))
+#define PACK_TYPE(a, b) ((a) | ((b) << LISP_TYPE_BITS))
 
 Expr number_div(Expr a, Expr b)
 {
@@ -2473,19 +3978,23 @@ Expr number_div(Expr a, Expr b)
     {
     case PACK_TYPE(TYPE_FLOAT, TYPE_FLOAT):
         return float_div(a, b);
-    case PACK_TYPE(TYPE_FIXNUM, TYPE_FIXUM):
+    case PACK_TYPE(TYPE_FIXNUM, TYPE_FIXNUM):
         {
-            // TODO use divmod?
-            Expr ret = fixnum_div(a, b);
-            if (a == fixnum_mul(ret, b))
+            I64 const num = fixnum_value(a);
+            I64 const den = fixnum_value(b);
+            if (den == 0)
             {
-                return ret;
+                LISP_FAIL("cannot divide %s by zero\n", repr(a));
             }
-            else
+            if (num % den == 0)
             {
-                return float_div(make_float(fixnum_value(a)), make_float(fixnum_value(b)));
+                return make_fixnum(num / den);
             }
+            return make_float((F32) num / (F32) den);
         }
+    case PACK_TYPE(TYPE_FIXNUM, TYPE_FLOAT):
+    case PACK_TYPE(TYPE_FLOAT, TYPE_FIXNUM):
+        return make_float(number_float_value(a) / number_float_value(b));
     default:
         LISP_FAIL("cannot divide %s by %s\n", repr(a), repr(b));
         return nil;
@@ -2496,7 +4005,32 @@ Expr number_div(Expr a, Expr b)
 
 bool number_equal(Expr a, Expr b)
 {
-    return fixnum_eq(a, b);
+    if (is_fixnum(a) && is_fixnum(b))
+    {
+        return fixnum_eq(a, b);
+    }
+    number_check(a, b, "compare");
+    return number_float_value(a) == number_float_value(b);
+}
+
+bool number_lt(Expr a, Expr b)
+{
+    if (is_fixnum(a) && is_fixnum(b))
+    {
+        return fixnum_lt(a, b);
+    }
+    number_check(a, b, "compare");
+    return number_float_value(a) < number_float_value(b);
+}
+
+bool number_le(Expr a, Expr b)
+{
+    if (is_fixnum(a) && is_fixnum(b))
+    {
+        return !fixnum_lt(b, a);
+    }
+    number_check(a, b, "compare");
+    return number_float_value(a) <= number_float_value(b);
 }
 
 #ifdef LISP_NAMESPACE
@@ -2551,17 +4085,43 @@ private:
 
 CoreImpl g_core(g_symbol, g_keyword);
 
+/* walks cdrs in a loop and keeps the cars still to compare on a stack
+   of its own, so that long or deeply nested lists cannot run out of C++
+   stack */
 bool equal(Expr a, Expr b)
 {
-    if (is_cons(a) && is_cons(b))
+    std::vector<Expr> todo;
+    for (;;)
     {
-        return equal(car(a), car(b)) && equal(cdr(a), cdr(b));
-    }
-    else if (is_string(a) && is_string(b))
-    {
-        return string_equal(a, b);
+        if (is_cons(a) && is_cons(b))
+        {
+            todo.push_back(car(a));
+            todo.push_back(car(b));
+            a = cdr(a);
+            b = cdr(b);
+            continue;
+        }
+        else if (is_string(a) && is_string(b))
+        {
+            if (!string_equal(a, b))
+            {
+                return false;
+            }
+        }
+        else if (!eq(a, b))
+        {
+            return false;
+        }
+
+        if (todo.empty())
+        {
+            return true;
+        }
+        b = todo.back();
+        todo.pop_back();
+        a = todo.back();
+        todo.pop_back();
     }
-    return eq(a, b);
 }
 
 bool all_eq(Expr exps)
@@ -2629,7 +4189,7 @@ bool is_named_call(Expr exp, Expr name)
 
 bool is_quote_call(Expr exp)
 {
-    return is_named_call(exp, intern("quote"));
+    return is_named_call(exp, LISP_SYM_QUOTE);
 }
 
 bool is_unquote(Expr exp)
@@ -2704,9 +4264,105 @@ Expr nreverse(Expr list)
     return prev;
 }
 
+/* the list functions below walk their lists in a loop, copies are made
+   front to back, one cons per element */
+
+U64 length(Expr seq)
+{
+    U64 ret = 0;
+    for (; is_cons(seq); seq = cdr(seq))
+    {
+        ++ret;
+    }
+    return ret;
+}
+
+Expr reverse(Expr seq)
+{
+    Expr ret = nil;
+    for (; is_cons(seq); seq = cdr(seq))
+    {
+        ret = cons(car(seq), ret);
+    }
+    return ret;
+}
+
+Expr copy_list(Expr seq)
+{
+    if (!is_cons(seq))
+    {
+        return seq;
+    }
+    Expr const ret = cons(car(seq), nil);
+    Expr tail = ret;
+    for (seq = cdr(seq); is_cons(seq); seq = cdr(seq))
+    {
+        Expr const next = cons(car(seq), nil);
+        rplacd(tail, next);
+        tail = next;
+    }
+    rplacd(tail, seq);
+    return ret;
+}
+
 Expr append(Expr a, Expr b)
 {
-    return a ? cons(car(a), append(cdr(a), b)) : b;
+    if (!a)
+    {
+        return b;
+    }
+    Expr const ret = copy_list(a);
+    rplacd(last(ret), b);
+    return ret;
+}
+
+Expr nthcdr(U64 n, Expr seq)
+{
+    for (; n > 0 && seq; --n)
+    {
+        seq = cdr(seq);
+    }
+    return seq;
+}
+
+Expr nth(U64 n, Expr seq)
+{
+    seq = nthcdr(n, seq);
+    return seq ? car(seq) : nil;
+}
+
+Expr last(Expr seq)
+{
+    while (is_cons(seq) && is_cons(cdr(seq)))
+    {
+        seq = cdr(seq);
+    }
+    return seq;
+}
+
+Expr member(Expr item, Expr seq)
+{
+    for (; is_cons(seq); seq = cdr(seq))
+    {
+        if (equal(item, car(seq)))
+        {
+            return seq;
+        }
+    }
+    return nil;
+}
+
+Expr assoc(Expr key, Expr alist)
+{
+    for (; is_cons(alist); alist = cdr(alist))
+    {
+        Expr const pair = car(alist);
+        if (is_cons(pair) && equal(key, car(pair)))
+        {
+            return pair;
+        }
+    }
+    return nil;
 }
 
 void load_file(char const * path, Expr env)
@@ -2715,6 +4371,10 @@ void load_file(char const * path, Expr env)
     Expr exp = nil;
     while (maybe_parse_expr(in, &exp))
     {
+        if (macro_expand_on_load())
+        {
+            exp = macroexpand_all(exp, env);
+        }
         eval(exp, env);
     }
     stream_release(in);
@@ -2727,9 +4387,9 @@ void repl(Expr env)
 loop:
     {
         /* read */
-        // TODO use global.stream.stdout
-        fprintf(stdout, "> ");
-        fflush(stdout);
+        Expr const out = stream_get_stdout();
+        stream_put_cstring(out, "> ");
+        stream_flush(out);
 
         Expr exp = nil;
         if (!maybe_parse_expr(in, &exp))
@@ -2762,27 +4422,32 @@ namespace LISP_NAMESPACE {
 
 Expr backquote_list(Expr seq, Expr env)
 {
-    if (seq)
+    Expr ret = nil;
+    GcRoot const ret_root(ret);
+    for (; seq; seq = cdr(seq))
     {
-        Expr item = car(seq);
-        Expr rest = cdr(seq);
+        Expr const item = car(seq);
         if (is_unquote_splicing(item))
         {
-            return append(eval(cadr(item), env), backquote_list(rest, env));
+            for (Expr tmp = eval(cadr(item), env); tmp; tmp = cdr(tmp))
+            {
+                ret = cons(car(tmp), ret);
+            }
         }
         else
         {
-            return cons(backquote(item, env), backquote_list(rest, env));
+            ret = cons(backquote(item, env), ret);
         }
     }
-    else
-    {
-        return nil;
-    }
+    return nreverse(ret);
 }
 
 Expr backquote(Expr exp, Expr env)
 {
+    if (eval_stack_low())
+    {
+        return eval_on_new_stack([&]() { return backquote(exp, env); });
+    }
     if (is_cons(exp))
     {
         if (is_unquote(exp))
@@ -2860,7 +4525,7 @@ public:
         switch (expr_type(exp))
         {
         case TYPE_STRING:
-            stream_put_cstring(out, string_value(exp));
+            stream_put_bytes(out, string_length(exp), (U8 const *) string_data(exp));
             break;
         case TYPE_CHAR:
             stream_put_char(out, char_code(exp));
@@ -2871,30 +4536,93 @@ public:
         }
     }
 
+    /* lists are printed from a stack of what is left to print rather than
+       by recursion, so that deeply nested ones cannot run out of C++
+       stack, each entry is an expr to print or, with a head, the rest of
+       the list it started */
     void print_expr(Expr exp, Expr out, HashSet<Expr> & seen)
     {
-        switch (expr_type(exp))
+        struct Todo
         {
-        case TYPE_NIL:
-            LISP_ASSERT_DEBUG(expr_data(exp) == 0);
-            stream_put_cstring(out, "nil");
-            break;
-        case TYPE_KEYWORD:
-            stream_put_char(out, ':');
-            stream_put_cstring(out, keyword_name(exp));
-            break;
-        case TYPE_SYMBOL:
-            stream_put_cstring(out, symbol_name(exp));
-            break;
-        case TYPE_CONS:
-            print_cons(exp, out, seen);
-            break;
-#if LISP_WANT_GENSYM
-        case TYPE_GENSYM:
-            stream_put_cstring(out, "#:G");
-            stream_put_u64(out, expr_data(exp));
-            break;
-#endif
+            Expr exp;
+            Expr head;
+        };
+        std::vector<Todo> todo;
+        todo.push_back({ exp, nil });
+        while (!todo.empty())
+        {
+            Todo const item = todo.back();
+            todo.pop_back();
+            if (item.head)
+            {
+                Expr const tmp = item.exp;
+                if (!tmp)
+                {
+                    stream_put_char(out, ')');
+                }
+                else if (tmp == item.head)
+                {
+                    stream_put_cstring(out, " ...)");
+                }
+                else if (is_cons(tmp))
+                {
+                    stream_put_char(out, ' ');
+                    todo.push_back({ cdr(tmp), item.head });
+                    todo.push_back({ car(tmp), nil });
+                }
+                else
+                {
+                    stream_put_cstring(out, " . ");
+                    todo.push_back({ nil, item.head });
+                    todo.push_back({ tmp, nil });
+                }
+            }
+            else if (!is_cons(item.exp))
+            {
+                print_atom(item.exp, out);
+            }
+#if LISP_PRINTER_PRINT_QUOTE
+            else if (is_quote_call(item.exp))
+            {
+                stream_put_char(out, '\'');
+                todo.push_back({ cadr(item.exp), nil });
+            }
+#endif
+            else if (seen.contains(item.exp))
+            {
+                stream_put_cstring(out, "...");
+            }
+            else
+            {
+                seen.add(item.exp);
+                stream_put_char(out, '(');
+                todo.push_back({ cdr(item.exp), item.exp });
+                todo.push_back({ car(item.exp), nil });
+            }
+        }
+    }
+
+    void print_atom(Expr exp, Expr out)
+    {
+        switch (expr_type(exp))
+        {
+        case TYPE_NIL:
+            LISP_ASSERT_DEBUG(expr_data(exp) == 0);
+            stream_put_cstring(out, "nil");
+            break;
+        case TYPE_KEYWORD:
+            stream_put_char(out, ':');
+            stream_put_cstring(out, keyword_name(exp));
+            break;
+        case TYPE_SYMBOL:
+            stream_put_cstring(out, symbol_name(exp));
+            break;
+#if LISP_WANT_GENSYM
+        case TYPE_GENSYM:
+            stream_put_cstring(out, "#:G");
+            stream_put_u64(out, expr_data(exp));
+            break;
+#endif
 #if LISP_WANT_POINTER
         case TYPE_POINTER:
             stream_put_cstring(out, "#:<pointer ");
@@ -2923,65 +4651,55 @@ public:
         case TYPE_BUILTIN_SYMBOL:
             print_builtin_symbol(exp, out);
             break;
+        case TYPE_CLOSURE_FUN:
+            print_closure(exp, out, "function");
+            break;
+        case TYPE_CLOSURE_MAC:
+            print_closure(exp, out, "macro");
+            break;
+        case TYPE_FRAME:
+            stream_put_cstring(out, "#:<frame>");
+            break;
+        case TYPE_LOCAL_REF:
+            stream_put_cstring(out, "#:<local ");
+            stream_put_u64(out, local_ref_depth(exp));
+            stream_put_char(out, ' ');
+            stream_put_u64(out, local_ref_slot(exp));
+            stream_put_cstring(out, ">");
+            break;
+        case TYPE_GLOBAL_REF:
+            stream_put_cstring(out, "#:<global ");
+            stream_put_cstring(out, symbol_name(global_ref_var(exp)));
+            stream_put_cstring(out, ">");
+            break;
         default:
             LISP_FAIL("cannot print expression %016" PRIx64 "\n", exp);
             break;
         }
     }
 
-    void print_cons(Expr exp, Expr out, HashSet<Expr> & seen)
+    void print_builtin(Expr exp, Expr out, char const * flavor)
     {
-#if LISP_PRINTER_PRINT_QUOTE
-        if (is_quote_call(exp))
-        {
-            stream_put_char(out, '\'');
-            print_expr(cadr(exp), out, seen);
-            return;
-        }
-#endif
-
-        if (seen.contains(exp))
-        {
-            stream_put_cstring(out, "...");
-            return;
-        }
-        seen.add(exp);
-
-        stream_put_char(out, '(');
-        print_expr(car(exp), out, seen);
-
-        for (Expr tmp = cdr(exp); tmp; tmp = cdr(tmp))
+        stream_put_cstring(out, "#:<");
+        stream_put_cstring(out, flavor);
+        char const * name = builtin_name(exp);
+        if (name)
         {
-            if (tmp == exp)
-            {
-                stream_put_cstring(out, " ...");
-                break;
-            }
-            else if (is_cons(tmp))
-            {
-                stream_put_char(out, ' ');
-                print_expr(car(tmp), out, seen);
-            }
-            else
-            {
-                stream_put_cstring(out, " . ");
-                print_expr(tmp, out, seen);
-                break;
-            }
+            stream_put_cstring(out, " ");
+            stream_put_cstring(out, name);
         }
-
-        stream_put_char(out, ')');
+        stream_put_cstring(out, ">");
     }
 
-    void print_builtin(Expr exp, Expr out, char const * flavor)
+    void print_closure(Expr exp, Expr out, char const * flavor)
     {
         stream_put_cstring(out, "#:<");
         stream_put_cstring(out, flavor);
-        char const * name = builtin_name(exp);
+        Expr const name = closure_name(exp);
         if (name)
         {
             stream_put_cstring(out, " ");
-            stream_put_cstring(out, name);
+            print_atom(name, out);
         }
         stream_put_cstring(out, ">");
     }
@@ -3028,7 +4746,7 @@ public:
     void print_string(Expr exp, Expr out)
     {
         stream_put_char(out, '"');
-        char const * str = string_value(exp);
+        char const * str = string_data(exp);
         size_t const len = string_length(exp);
         for (size_t i = 0; i < len; ++i)
         {
@@ -3128,6 +4846,84 @@ Expr b_println(Expr args, Expr env)
 namespace LISP_NAMESPACE {
 #endif
 
+/* the length of the run before the first NUL, stop byte or, with ascii
+   set, byte of a multi-byte char, sixteen bytes at a time with sse2 */
+static size_t read_scan_until(U8 const * data, size_t size, char const * stops, bool ascii)
+{
+    size_t pos = 0;
+#if LISP_READER_SIMD && defined(__SSE2__)
+    __m128i const zero = _mm_setzero_si128();
+    __m128i const high = ascii ? _mm_set1_epi8((char) 0x80) : zero;
+    for (; pos + 16 <= size; pos += 16)
+    {
+        __m128i const chunk = _mm_loadu_si128((__m128i const *) (data + pos));
+        __m128i hits = _mm_or_si128(_mm_cmpeq_epi8(chunk, zero), _mm_and_si128(chunk, high));
+        for (char const * stop = stops; *stop; ++stop)
+        {
+            hits = _mm_or_si128(hits, _mm_cmpeq_epi8(chunk, _mm_set1_epi8(*stop)));
+        }
+        int const mask = _mm_movemask_epi8(hits);
+        if (mask)
+        {
+            return pos + __builtin_ctz(mask);
+        }
+    }
+#endif
+    for (; pos < size; ++pos)
+    {
+        U8 const ch = data[pos];
+        if (ch == 0 || (ascii && (ch & 0x80)) || strchr(stops, ch))
+        {
+            return pos;
+        }
+    }
+    return pos;
+}
+
+/* the length of the run of blanks the reader skips */
+static size_t read_scan_blank(U8 const * data, size_t size)
+{
+    size_t pos = 0;
+#if LISP_READER_SIMD && defined(__SSE2__)
+    for (; pos + 16 <= size; pos += 16)
+    {
+        __m128i const chunk = _mm_loadu_si128((__m128i const *) (data + pos));
+        __m128i const blank = _mm_or_si128(_mm_cmpeq_epi8(chunk, _mm_set1_epi8(' ')),
+                                           _mm_or_si128(_mm_cmpeq_epi8(chunk, _mm_set1_epi8('\n')),
+                                                        _mm_cmpeq_epi8(chunk, _mm_set1_epi8('\t'))));
+        int const mask = ~_mm_movemask_epi8(blank) & 0xffff;
+        if (mask)
+        {
+            return pos + __builtin_ctz(mask);
+        }
+    }
+#endif
+    for (; pos < size; ++pos)
+    {
+        U8 const ch = data[pos];
+        if (ch != ' ' && ch != '\n' && ch != '\t')
+        {
+            return pos;
+        }
+    }
+    return pos;
+}
+
+enum
+{
+    READ_ITEMS,
+    READ_DOT,
+    READ_DOTTED,
+};
+
+struct ReadFrame
+{
+    Expr head;
+    Expr tail;
+    Expr quote;
+    U64 state;
+};
+
 class ReadImpl
 {
 public:
@@ -3151,18 +4947,127 @@ public:
         return true;
     }
 
+    /* lists and quotes nest on m_open rather than on the C++ stack, so
+       that deeply nested input reads like any other, each open list
+       keeps its first and last cons, a quote the symbol it wraps the
+       next expression in */
     Expr parse_expr(Expr in)
     {
-        skip_whitespace_or_comment(in);
-
-        char lexeme[4096] = { 0 };
-        Expr tok = nil;
+        m_open.clear();
+        Expr exp = nil;
 
-        if (stream_peek_char(in) == '(')
+        for (;;)
         {
-            return parse_list(in);
+            skip_whitespace_or_comment(in);
+            U32 const ch = stream_peek_char(in);
+
+            if (!m_open.empty() && m_open.back().quote == nil)
+            {
+                ReadFrame & frame = m_open.back();
+                if (ch == 0)
+                {
+                    LISP_FAIL("unexpected eof\n");
+                    return nil;
+                }
+                else if (frame.state == READ_DOTTED && ch != ')')
+                {
+                    LISP_FAIL("missing ')'\n");
+                    return nil;
+                }
+                else if (ch == ')' && frame.state != READ_DOT)
+                {
+                    stream_skip_char(in);
+                    exp = frame.head;
+                    m_open.pop_back();
+                    goto done;
+                }
+            }
+
+            if (ch == '(')
+            {
+                stream_skip_char(in);
+                m_open.push_back(ReadFrame { nil, nil, nil, READ_ITEMS });
+                continue;
+            }
+#if LISP_READER_PARSE_QUOTE
+            else if (ch == '\'')
+            {
+                stream_skip_char(in);
+                m_open.push_back(ReadFrame { nil, nil, LISP_SYM_QUOTE, READ_ITEMS });
+                continue;
+            }
+            else if (ch == '`')
+            {
+                stream_skip_char(in);
+                m_open.push_back(ReadFrame { nil, nil, LISP_SYM_BACKQUOTE, READ_ITEMS });
+                continue;
+            }
+            else if (ch == ',')
+            {
+                stream_skip_char(in);
+                Expr quote = LISP_SYM_UNQUOTE;
+                if (stream_peek_char(in) == '@')
+                {
+                    stream_skip_char(in);
+                    quote = LISP_SYM_UNQUOTE_SPLICING;
+                }
+                m_open.push_back(ReadFrame { nil, nil, quote, READ_ITEMS });
+                continue;
+            }
+#endif
+            exp = parse_atom(in);
+
+        done:
+            /* hands exp to what it is nested in, up to the next open list */
+            while (!m_open.empty())
+            {
+                ReadFrame & frame = m_open.back();
+                if (frame.quote != nil)
+                {
+                    exp = list(frame.quote, exp);
+                    m_open.pop_back();
+                    continue;
+                }
+
+                // TODO get rid of artifical symbol dependence for dotted lists
+                if (frame.state == READ_DOT)
+                {
+                    rplacd(frame.tail, exp);
+                    frame.state = READ_DOTTED;
+                }
+                else if (exp == LISP_SYM_DOT)
+                {
+                    frame.state = READ_DOT;
+                }
+                else
+                {
+                    Expr const next = cons(exp, nil);
+                    if (frame.head)
+                    {
+                        rplacd(frame.tail, next);
+                        frame.tail = next;
+                    }
+                    else
+                    {
+                        frame.head = frame.tail = next;
+                    }
+                }
+                break;
+            }
+            if (m_open.empty())
+            {
+                return exp;
+            }
         }
-        else if (stream_peek_char(in) == '"')
+    }
+
+    /* anything but a list or a quote, at the next char */
+    Expr parse_atom(Expr in)
+    {
+        char lexeme[4096];
+        Expr tok = nil;
+
+        if (stream_peek_char(in) == '"')
         {
             return parse_string(in);
         }
@@ -3179,7 +5084,7 @@ public:
             stream_release(tok);
 
             // handle printable characters
-            if (lexeme[2] == 0)
+            if (lexeme[1] == 0 || lexeme[2] == 0)
             {
                 return make_char(lexeme[1]);
             }
@@ -3198,113 +5103,6 @@ public:
             }
         }
 #endif
-#if LISP_READER_PARSE_QUOTE
-        else if (stream_peek_char(in) == '\'')
-        {
-            stream_skip_char(in);
-            Expr const exp = list(intern("quote"), parse_expr(in));
-            return exp;
-        }
-        else if (stream_peek_char(in) == '`')
-        {
-            stream_skip_char(in);
-            Expr const exp = list(intern("backquote"), parse_expr(in));
-            return exp;
-        }
-        else if (stream_peek_char(in) == ',')
-        {
-            stream_skip_char(in);
-            if (stream_peek_char(in) == '@')
-            {
-                stream_skip_char(in);
-                return list(intern("unquote-splicing"), parse_expr(in));
-            }
-            return list(intern("unquote"), parse_expr(in));
-        }
-#endif
-
-        else if (is_number_start(stream_peek_char(in)))
-        {
-            tok = make_buffer_output_stream(4096, lexeme);
-
-            bool neg = 0;
-            if (stream_peek_char(in) == '-')
-            {
-                neg = 1;
-                stream_put_char(tok, stream_read_char(in));
-            }
-            else if (stream_peek_char(in) == '+')
-            {
-                stream_put_char(tok, stream_read_char(in));
-            }
-
-            if (is_number_part(stream_peek_char(in)))
-            {
-                Expr val = make_number(0);
-                Expr ten = make_number(10);
-                Expr one = make_number(1);
-                Expr den = one;
-
-                // TODO extract function: parse_int
-                while (1)
-                {
-                    char const ch = stream_peek_char(in);
-                    if (!is_number_part(ch))
-                    {
-                        break;
-                    }
-
-                    I64 const digit = ch - '0';
-
-                    val = number_mul(val, ten);
-                    val = number_add(val, make_number(digit));
-
-                    stream_put_char(tok, stream_read_char(in));
-                }
-
-                // TODO
-                if (stream_peek_char(in) == '.')
-                {
-                    stream_put_char(tok, stream_read_char(in));
-
-                    while (1)
-                    {
-                        char const ch = stream_peek_char(in);
-                        if (!is_number_part(ch))
-                        {
-                            break;
-                        }
-
-                        I64 const digit = ch - '0';
-
-                        val = number_mul(val, ten);
-                        val = number_add(val, make_number(digit));
-                        den = number_mul(den, ten);
-
-                        stream_put_char(tok, stream_read_char(in));
-                    }
-                }
-
-                if (neg)
-                {
-                    val = number_neg(val);
-                }
-
-                if (!is_number_stop(stream_peek_char(in)))
-                {
-                    goto symbol_loop;
-                }
-
-                if (!number_equal(den, one))
-                {
-                    val = number_div(val, den);
-                }
-
-                return val;
-            }
-
-            goto symbol_loop;
-        }
 
         else if (is_symbol_start(stream_peek_char(in)))
         {
@@ -3312,6 +5110,7 @@ public:
             stream_put_char(tok, stream_read_char(in));
 
         symbol_loop:
+            copy_run(in, tok, " \n\t\"();'");
             if (is_symbol_part(stream_peek_char(in)))
             {
                 stream_put_char(tok, stream_read_char(in));
@@ -3324,9 +5123,14 @@ public:
 
         symbol_done:
             stream_put_char(tok, 0);
-            Expr const ret = intern(lexeme);
             stream_release(tok);
-            return ret;
+
+            Expr num = nil;
+            if (is_number_start(lexeme[0]) && parse_number(lexeme, &num))
+            {
+                return num;
+            }
+            return intern(lexeme);
         }
         else
         {
@@ -3335,91 +5139,36 @@ public:
         }
     }
 
-    Expr parse_list(Expr in)
+    Expr parse_string(Expr in)
     {
-        Expr exp = nil;
-        Expr head = nil;
-        Expr tail = nil;
+        enum
+        {
+            STATE_DEFAULT,
+            STATE_ESCAPE,
+        } state = STATE_DEFAULT;
 
-        if (stream_peek_char(in) != '(')
+        if (stream_peek_char(in) != '"')
         {
-            LISP_FAIL("expected '(', got '%c'\n", stream_peek_char(in));
+            LISP_FAIL("missing '\"'\n");
             return nil;
         }
-
         stream_skip_char(in);
 
-    list_loop:
-        skip_whitespace_or_comment(in);
-
-        if (stream_peek_char(in) == 0)
+        /* a literal without escapes in a buffer is copied in one go */
+        size_t size = 0;
+        U8 const * data = stream_span(in, &size);
+        if (data)
         {
-            LISP_FAIL("unexpected eof\n");
-            return nil;
-        }
-
-        if (stream_peek_char(in) == ')')
-        {
-            goto list_done;
-        }
-
-        exp = parse_expr(in);
-
-        // TODO get rid of artifical symbol dependence for dotted lists
-        if (exp == intern("."))
-        {
-            exp = parse_expr(in);
-            rplacd(tail, exp);
-
-            skip_whitespace_or_comment(in);
-
-            goto list_done;
-        }
-        else
-        {
-            Expr next = cons(exp, nil);
-            if (head)
-            {
-                rplacd(tail, next);
-                tail = next;
-            }
-            else
+            size_t const len = read_scan_until(data, size, "\"\\", true);
+            if (len < size && data[len] == '"')
             {
-                head = tail = next;
+                Expr const ret = make_string_bytes((char const *) data, len);
+                stream_advance(in, len + 1);
+                return ret;
             }
         }
 
-        goto list_loop;
-
-    list_done:
-        // TODO use expect_char(in, ')')
-        if (stream_peek_char(in) != ')')
-        {
-            LISP_FAIL("missing ')'\n");
-            return nil;
-        }
-        stream_skip_char(in);
-
-        return head;
-    }
-
-    Expr parse_string(Expr in)
-    {
-        enum
-        {
-            STATE_DEFAULT,
-            STATE_ESCAPE,
-        } state = STATE_DEFAULT;
-
-        if (stream_peek_char(in) != '"')
-        {
-            LISP_FAIL("missing '\"'\n");
-            return nil;
-        }
-        stream_skip_char(in);
-
-        char lexeme[4096];
-        Expr tok = make_buffer_output_stream(4096, lexeme);
+        Expr tok = make_string_output_stream();
 
     string_loop:
         if (stream_peek_char(in) == 0)
@@ -3430,7 +5179,12 @@ public:
 
         else if (state == STATE_DEFAULT)
         {
-            if (stream_peek_char(in) == '"')
+            copy_run(in, tok, "\"\\");
+            if (stream_peek_char(in) == 0)
+            {
+                goto string_loop;
+            }
+            else if (stream_peek_char(in) == '"')
             {
                 stream_skip_char(in);
                 goto string_done;
@@ -3490,40 +5244,162 @@ public:
         goto string_loop;
 
     string_done:
-        stream_put_char(tok, 0);
-        Expr const ret = make_string(lexeme);
+        Expr const ret = make_string(stream_string_value(tok));
         stream_release(tok);
         return ret;
     }
 
-    char parse_hex_digit(Expr in, char val)
+    /* [+-]digits[.digits][e[+-]digits] or [+-]0xhexdigits, a token that
+       does not fit is a symbol; integers are fixnums and fail when out of
+       range, anything with a point or an exponent is a float */
+    bool parse_number(char const * str, Expr * out)
     {
-        char const ch = stream_read_char(in);
+        char const * pos = str;
+        bool const neg = *pos == '-';
+        if (*pos == '-' || *pos == '+')
+        {
+            ++pos;
+        }
+        if (!is_number_part(*pos))
+        {
+            return false;
+        }
 
-        if (ch >= '0' && ch <= '9')
+        U64 const limit = (U64) LISP_FIXNUM_MAXVAL + (neg ? 1 : 0);
+        U64 mant = 0;
+        bool overflow = false;
+
+        if (pos[0] == '0' && (pos[1] == 'x' || pos[1] == 'X') && pos[2])
+        {
+            for (pos += 2; *pos; ++pos)
+            {
+                int const digit = hex_digit_value(*pos);
+                if (digit < 0)
+                {
+                    return false;
+                }
+                overflow = overflow || mant > (limit - digit) / 16;
+                mant = mant * 16 + digit;
+            }
+            return make_integer(str, neg, mant, overflow, out);
+        }
+
+        /* digits past what a U64 holds only move the exponent */
+        int exp10 = 0;
+        bool truncated = false;
+        for (; is_number_part(*pos); ++pos)
+        {
+            if (mant > (UINT64_MAX - 9) / 10)
+            {
+                truncated = true;
+                ++exp10;
+                continue;
+            }
+            mant = mant * 10 + (*pos - '0');
+        }
+
+        bool real = false;
+        if (*pos == '.')
+        {
+            real = true;
+            for (++pos; is_number_part(*pos); ++pos)
+            {
+                if (mant > (UINT64_MAX - 9) / 10)
+                {
+                    truncated = true;
+                    continue;
+                }
+                mant = mant * 10 + (*pos - '0');
+                --exp10;
+            }
+        }
+
+        if (*pos == 'e' || *pos == 'E')
         {
-            val *= 16;
-            val += ch - '0';
+            real = true;
+            ++pos;
+            bool const exp_neg = *pos == '-';
+            if (*pos == '-' || *pos == '+')
+            {
+                ++pos;
+            }
+            if (!is_number_part(*pos))
+            {
+                return false;
+            }
+            int exp = 0;
+            for (; is_number_part(*pos); ++pos)
+            {
+                exp = std::min(exp * 10 + (*pos - '0'), 100000);
+            }
+            exp10 += exp_neg ? -exp : exp;
         }
 
-        else if (ch >= 'a' && ch <= 'f')
+        if (*pos)
         {
-            val *= 16;
-            val += 10 + ch - 'a';
+            return false;
         }
 
-        else if (ch >= 'A' && ch <= 'F')
+        if (!real)
         {
-            val *= 16;
-            val += 10 + ch - 'A';
+            return make_integer(str, neg, mant, truncated || mant > limit, out);
         }
 
+        /* exact operands and one rounding when both fit a float, which
+           covers most literals, the rest goes to the correctly rounded
+           strtof */
+        static F32 const powers[] = { 1e0f, 1e1f, 1e2f, 1e3f, 1e4f, 1e5f, 1e6f, 1e7f, 1e8f, 1e9f, 1e10f };
+        F32 val;
+        if (!truncated && mant <= (UINT64_C(1) << 24) && exp10 >= -10 && exp10 <= 10)
+        {
+            val = (F32) mant;
+            val = exp10 < 0 ? val / powers[-exp10] : val * powers[exp10];
+            val = neg ? -val : val;
+        }
         else
         {
-            LISP_FAIL("malformed string");
+            val = strtof(str, NULL);
+        }
+        *out = make_float(val);
+        return true;
+    }
+
+    bool make_integer(char const * str, bool neg, U64 mant, bool overflow, Expr * out)
+    {
+        if (overflow)
+        {
+            LISP_FAIL("integer %s does not fit a fixnum\n", str);
+            return false;
+        }
+        *out = make_fixnum(neg ? -(I64) mant : (I64) mant);
+        return true;
+    }
+
+    int hex_digit_value(char ch)
+    {
+        if (ch >= '0' && ch <= '9')
+        {
+            return ch - '0';
+        }
+        if (ch >= 'a' && ch <= 'f')
+        {
+            return 10 + ch - 'a';
         }
+        if (ch >= 'A' && ch <= 'F')
+        {
+            return 10 + ch - 'A';
+        }
+        return -1;
+    }
 
-        return val;
+    char parse_hex_digit(Expr in, char val)
+    {
+        int const digit = hex_digit_value(stream_read_char(in));
+        if (digit < 0)
+        {
+            LISP_FAIL("malformed string");
+        }
+        return val * 16 + digit;
     }
 
     bool is_whitespace(U32 ch)
@@ -3564,13 +5440,40 @@ public:
         return is_number_part(ch) || ch == '-' || ch == '+';
     }
 
-    bool is_number_stop(U32 ch)
+    /* moves the ascii run up to the next stop from a buffer stream
+       into the token, the caller goes on a char at a time from there */
+    void copy_run(Expr in, Expr tok, char const * stops)
     {
-        return ch == 0 || ch == ')' || is_whitespace(ch);
+        size_t size = 0;
+        U8 const * data = stream_span(in, &size);
+        if (data)
+        {
+            size_t const len = read_scan_until(data, size, stops, true);
+            stream_put_bytes(tok, len, data);
+            stream_advance(in, len);
+        }
     }
 
     void skip_whitespace_or_comment(Expr in)
     {
+        size_t size = 0;
+        U8 const * data = stream_span(in, &size);
+        if (data)
+        {
+            size_t pos = 0;
+            while (true)
+            {
+                pos += read_scan_blank(data + pos, size - pos);
+                if (pos == size || data[pos] != ';')
+                {
+                    break;
+                }
+                pos += read_scan_until(data + pos, size - pos, "\n", false);
+            }
+            stream_advance(in, pos);
+            return;
+        }
+
     whitespace:
         while (is_whitespace(stream_peek_char(in)))
         {
@@ -3599,6 +5502,9 @@ public:
         stream_skip_char(in);
         goto comment;
     }
+
+private:
+    std::vector<ReadFrame> m_open;
 };
 
 ReadImpl g_read;
@@ -3622,55 +5528,20 @@ Expr read_one_from_string(char const * src)
 namespace LISP_NAMESPACE {
 #endif
 
-#if LISP_CLOSURE_USE_CONS
-
-/* (lit clo <env> <args> . <body>) */
-/* (lit mac <env> <args> . <body>) */
-
-bool is_closure(Expr exp, Expr kind)
-{
-    return is_cons(exp) &&
-        eq(intern("lit"), car(exp)) &&
-        is_cons(cdr(exp)) &&
-        eq(kind, cadr(exp));
-}
-
-Expr closure_env(Expr exp)
-{
-    return caddr(exp);
-}
-
-Expr closure_args(Expr exp)
-{
-    return cadddr(exp);
-}
-
-Expr closure_body(Expr exp)
-{
-    return cddddr(exp);
-}
-
-bool is_function(Expr exp)
-{
-    return is_closure(exp, intern("clo"));
-}
-
-Expr make_function(Expr env, Expr /*name*/, Expr args, Expr body)
-{
-    return cons(intern("lit"), cons(intern("clo"), cons(env, cons(args, body))));
-}
+/* closures are objects of their own, with LISP_CLOSURE_USE_CONS they
+   are made as the Bel lists
 
-bool is_macro(Expr exp)
-{
-    return is_closure(exp, intern("mac"));
-}
+   (lit clo <env> <args> . <body>)
+   (lit mac <env> <args> . <body>)
 
-Expr make_macro(Expr env, Expr /*name*/, Expr args, Expr body)
-{
-    return cons(intern("lit"), cons(intern("mac"), cons(env, cons(args, body))));
-}
+   instead, and with LISP_CLOSURE_ACCEPT_LISTS such lists are closures
+   too, each list is decoded once into an object kept by its head, so
+   calls do not parse it again, changing the list after it has been
+   called is not seen */
 
-#else
+#if LISP_CLOSURE_USE_CONS && !LISP_CLOSURE_ACCEPT_LISTS
+#error "closure lists need LISP_CLOSURE_ACCEPT_LISTS"
+#endif
 
 struct Closure
 {
@@ -3683,24 +5554,48 @@ struct Closure
 class ClosureImpl
 {
 public:
-    ClosureImpl()
+    ClosureImpl() : m_funs(LISP_GC_GENERATIONAL), m_macs(LISP_GC_GENERATIONAL)
     {
     }
 
     Expr make_function(Expr env, Expr name, Expr args, Expr body)
     {
-        Closure const clo = { env, name, args, body };
-        U64 const index = (U64) m_funs.size();
-        m_funs.push_back(clo);
-        return make_expr(TYPE_CLOSURE_FUN, index);
+#if LISP_CLOSURE_USE_CONS
+        return make_list(LISP_SYM_CLO, make_object(TYPE_CLOSURE_FUN, env, name, args, body));
+#else
+        return make_object(TYPE_CLOSURE_FUN, env, name, args, body);
+#endif
     }
 
     Expr make_macro(Expr env, Expr name, Expr args, Expr body)
     {
-        Closure const clo = { env, name, args, body };
-        U64 const index = (U64) m_macs.size();
-        m_macs.push_back(clo);
-        return make_expr(TYPE_CLOSURE_MAC, index);
+#if LISP_CLOSURE_USE_CONS
+        return make_list(LISP_SYM_MAC, make_object(TYPE_CLOSURE_MAC, env, name, args, body));
+#else
+        return make_object(TYPE_CLOSURE_MAC, env, name, args, body);
+#endif
+    }
+
+    bool is_function(Expr exp)
+    {
+#if LISP_CLOSURE_ACCEPT_LISTS
+        if (is_cons(exp))
+        {
+            return expr_type(decoded(exp)) == TYPE_CLOSURE_FUN;
+        }
+#endif
+        return expr_type(exp) == TYPE_CLOSURE_FUN;
+    }
+
+    bool is_macro(Expr exp)
+    {
+#if LISP_CLOSURE_ACCEPT_LISTS
+        if (is_cons(exp))
+        {
+            return expr_type(decoded(exp)) == TYPE_CLOSURE_MAC;
+        }
+#endif
+        return expr_type(exp) == TYPE_CLOSURE_MAC;
     }
 
     Expr env(Expr exp)
@@ -3723,25 +5618,168 @@ public:
         return ref(exp).body;
     }
 
+    bool is_marked(Expr exp)
+    {
+        return pool(exp).is_marked(expr_data(exp));
+    }
+
+    bool mark(Expr exp, bool young_only)
+    {
+        return pool(exp).mark(expr_data(exp), young_only);
+    }
+
+    U64 sweep()
+    {
+        return m_funs.sweep() + m_macs.sweep();
+    }
+
+    U64 sweep_young()
+    {
+        return m_funs.sweep_young() + m_macs.sweep_young();
+    }
+
+    U64 live() const
+    {
+        return m_funs.live() + m_macs.live();
+    }
+
+    U64 made() const
+    {
+        return m_funs.made() + m_macs.made();
+    }
+
+    /* the decoded lists do not keep their heads alive, see
+       GcImpl::trace_weak, a minor collection keeps both */
+
+    template <typename Func>
+    void each_value(Func func)
+    {
+        for (auto & it : m_lists)
+        {
+            func(it.first);
+            func(it.second.closure);
+        }
+    }
+
+    template <typename Pred, typename Func>
+    bool each_reachable_value(Pred is_reachable, Func func)
+    {
+        bool found = false;
+        for (auto & it : m_lists)
+        {
+            if (!it.second.traced && is_reachable(it.first))
+            {
+                it.second.traced = true;
+                func(it.second.closure);
+                found = true;
+            }
+        }
+        return found;
+    }
+
+    template <typename Pred>
+    void sweep(Pred is_reachable)
+    {
+        for (auto it = m_lists.begin(); it != m_lists.end();)
+        {
+            if (is_reachable(it->first))
+            {
+                it->second.traced = false;
+                ++it;
+            }
+            else
+            {
+                it = m_lists.erase(it);
+            }
+        }
+    }
+
 protected:
+    struct Decoded
+    {
+        Expr closure;
+        bool traced;
+    };
+
+    Expr make_object(U64 type, Expr env, Expr name, Expr args, Expr body)
+    {
+        Closure const clo = { env, name, args, body };
+        U64 const index = (type == TYPE_CLOSURE_FUN ? m_funs : m_macs).make(clo);
+        return make_expr(type, index);
+    }
+
+    Expr make_list(Expr kind, Expr closure)
+    {
+        Closure const & clo = ref(closure);
+        Expr const ret = cons(LISP_SYM_LIT, cons(kind, cons(clo.env, cons(clo.args, clo.body))));
+        m_lists[ret] = { closure, false };
+        return ret;
+    }
+
+    /* the object for a closure list, or nil for any other cons */
+    Expr decoded(Expr exp)
+    {
+        auto const it = m_lists.find(exp);
+        if (it != m_lists.end())
+        {
+            return it->second.closure;
+        }
+        if (!is_cons(cdr(exp)) || !eq(LISP_SYM_LIT, car(exp)))
+        {
+            return nil;
+        }
+        if (!is_cons(cddr(exp)) || !is_cons(cdddr(exp)))
+        {
+            return nil;
+        }
+        Expr const kind = cadr(exp);
+        U64 type;
+        if (eq(kind, LISP_SYM_CLO))
+        {
+            type = TYPE_CLOSURE_FUN;
+        }
+        else if (eq(kind, LISP_SYM_MAC))
+        {
+            type = TYPE_CLOSURE_MAC;
+        }
+        else
+        {
+            return nil;
+        }
+        Expr const closure = make_object(type, caddr(exp), nil, cadddr(exp), cddddr(exp));
+        m_lists[exp] = { closure, false };
+        return closure;
+    }
+
     Closure & ref(Expr exp)
     {
-        static Closure nul;
+#if LISP_CLOSURE_ACCEPT_LISTS
+        if (is_cons(exp))
+        {
+            exp = decoded(exp);
+        }
+#endif
+        return pool(exp)[expr_data(exp)];
+    }
+
+    Pool<Closure> & pool(Expr exp)
+    {
         switch (expr_type(exp))
         {
         case TYPE_CLOSURE_FUN:
-            return m_funs[expr_data(exp)];
+            return m_funs;
         case TYPE_CLOSURE_MAC:
-            return m_macs[expr_data(exp)];
+            return m_macs;
         default:
             LISP_FAIL("not a closure: %s\n", repr(exp));
-            return nul;
+            return m_funs;
         }
     }
 
 private:
-    std::vector<Closure> m_funs;
-    std::vector<Closure> m_macs;
+    Pool<Closure> m_funs;
+    Pool<Closure> m_macs;
+    std::unordered_map<Expr, Decoded> m_lists;
 };
 
 ClosureImpl g_closure;
@@ -3761,9 +5799,14 @@ Expr closure_body(Expr exp)
     return g_closure.body(exp);
 }
 
+Expr closure_name(Expr exp)
+{
+    return g_closure.name(exp);
+}
+
 bool is_function(Expr exp)
 {
-    return expr_type(exp) == TYPE_CLOSURE_FUN;
+    return g_closure.is_function(exp);
 }
 
 Expr make_function(Expr env, Expr name, Expr args, Expr body)
@@ -3773,7 +5816,7 @@ Expr make_function(Expr env, Expr name, Expr args, Expr body)
 
 bool is_macro(Expr exp)
 {
-    return expr_type(exp) == TYPE_CLOSURE_MAC;
+    return g_closure.is_macro(exp);
 }
 
 Expr make_macro(Expr env, Expr name, Expr args, Expr body)
@@ -3781,61 +5824,410 @@ Expr make_macro(Expr env, Expr name, Expr args, Expr body)
     return g_closure.make_macro(env, name, args, body);
 }
 
-#endif
-
 #ifdef LISP_NAMESPACE
 }
 #endif
 
-#line 2 "src/env.impl"
+#line 2 "src/frame.impl"
 #ifdef LISP_NAMESPACE
 namespace LISP_NAMESPACE {
 #endif
 
-class EnvImpl
+/* call frame of an analyzed closure, the analyzed body refers to its
+   slots by index, names are kept for lookups by name from code that was
+   not analyzed, and anything def'd into it later goes to extra, a
+   (<vars> . <vals>) pair like the one of a cons env */
+
+struct Frame
+{
+    Expr names;
+    Expr outer;
+    Expr extra;
+    std::vector<Expr> slots;
+};
+
+class FrameImpl
+{
+public:
+    FrameImpl(U64 type) : m_type(type), m_frames(LISP_GC_GENERATIONAL)
+    {
+    }
+
+    inline bool isinstance(Expr exp) const
+    {
+        return expr_type(exp) == m_type;
+    }
+
+    Expr make(Expr names, U64 size, Expr outer)
+    {
+        Frame frame;
+        frame.names = names;
+        frame.outer = outer;
+        frame.extra = nil;
+        U64 const index = m_frames.make(frame);
+        m_frames[index].slots.assign(size, nil);
+        return make_expr(m_type, index);
+    }
+
+    Expr names(Expr exp)
+    {
+        return ref(exp).names;
+    }
+
+    Expr outer(Expr exp)
+    {
+        return ref(exp).outer;
+    }
+
+    U64 size(Expr exp)
+    {
+        return (U64) ref(exp).slots.size();
+    }
+
+    Expr get(Expr exp, U64 slot)
+    {
+        Frame & frame = ref(exp);
+        LISP_ASSERT_DEBUG(slot < frame.slots.size());
+        return frame.slots[slot];
+    }
+
+    void set(Expr exp, U64 slot, Expr val)
+    {
+        Frame & frame = ref(exp);
+        LISP_ASSERT_DEBUG(slot < frame.slots.size());
+        frame.slots[slot] = val;
+        m_frames.remember(expr_data(exp));
+    }
+
+    Expr extra(Expr exp)
+    {
+        return ref(exp).extra;
+    }
+
+    void set_extra(Expr exp, Expr extra)
+    {
+        ref(exp).extra = extra;
+        m_frames.remember(expr_data(exp));
+    }
+
+    template <typename Func>
+    void each_child(Expr exp, Func func)
+    {
+        Frame & frame = ref(exp);
+        func(frame.names);
+        func(frame.outer);
+        func(frame.extra);
+        for (auto val : frame.slots)
+        {
+            func(val);
+        }
+    }
+
+    template <typename Func>
+    void each_remembered(Func func)
+    {
+        auto const & remembered = m_frames.remembered();
+        for (U64 i = 0; i < remembered.size(); ++i)
+        {
+            func(make_expr(m_type, remembered[i]));
+        }
+    }
+
+    bool mark(Expr exp, bool young_only)
+    {
+        LISP_ASSERT(isinstance(exp));
+        return m_frames.mark(expr_data(exp), young_only);
+    }
+
+    U64 sweep()
+    {
+        return m_frames.sweep();
+    }
+
+    U64 sweep_young()
+    {
+        return m_frames.sweep_young();
+    }
+
+    U64 live() const
+    {
+        return m_frames.live();
+    }
+
+    U64 made() const
+    {
+        return m_frames.made();
+    }
+
+protected:
+    Frame & ref(Expr exp)
+    {
+        LISP_ASSERT(isinstance(exp));
+        return m_frames[expr_data(exp)];
+    }
+
+private:
+    U64 m_type;
+    Pool<Frame> m_frames;
+};
+
+#if LISP_WANT_GLOBAL_API
+
+FrameImpl g_frame(TYPE_FRAME);
+
+bool is_frame(Expr exp)
+{
+    return g_frame.isinstance(exp);
+}
+
+Expr make_frame(Expr names, U64 size, Expr outer)
+{
+    return g_frame.make(names, size, outer);
+}
+
+Expr frame_names(Expr frame)
+{
+    return g_frame.names(frame);
+}
+
+Expr frame_outer(Expr frame)
+{
+    return g_frame.outer(frame);
+}
+
+U64 frame_size(Expr frame)
+{
+    return g_frame.size(frame);
+}
+
+Expr frame_get(Expr frame, U64 slot)
+{
+    return g_frame.get(frame, slot);
+}
+
+void frame_set(Expr frame, U64 slot, Expr val)
+{
+    g_frame.set(frame, slot, val);
+}
+
+Expr frame_extra(Expr frame)
+{
+    return g_frame.extra(frame);
+}
+
+void frame_set_extra(Expr frame, Expr extra)
+{
+    g_frame.set_extra(frame, extra);
+}
+
+static void frame_bind_slots(Expr frame, Expr vars, Expr vals, U64 & slot)
+{
+    if (vars == nil)
+    {
+        if (vals != nil)
+        {
+            LISP_FAIL("no more parameters to bind\n");
+        }
+    }
+    else if (is_cons(vars))
+    {
+        for (; is_cons(vars); vars = cdr(vars), vals = cdr(vals))
+        {
+            LISP_ASSERT(is_cons(vals));
+            frame_bind_slots(frame, car(vars), car(vals), slot);
+        }
+        if (vars)
+        {
+            frame_bind_slots(frame, vars, vals, slot);
+        }
+    }
+    else
+    {
+        frame_set(frame, slot++, vals);
+    }
+}
+
+/* binds like a cons env would, in the order AnalyzeImpl::flatten names
+   the slots */
+void frame_bind(Expr frame, Expr vars, Expr vals)
+{
+    U64 slot = 0;
+    frame_bind_slots(frame, vars, vals, slot);
+}
+
+static bool frame_is_var(Expr exp)
+{
+#if LISP_WANT_GENSYM
+    return is_symbol(exp) || is_gensym(exp);
+#else
+    return is_symbol(exp);
+#endif
+}
+
+/* same as frame_bind for a list of count vals, without making the list
+   unless there are rest or nested parameters */
+void frame_bind_values(Expr frame, Expr params, Expr const * vals, U64 count)
+{
+    Expr vars = params;
+    U64 slot = 0;
+    for (; is_cons(vars) && frame_is_var(car(vars)); vars = cdr(vars), ++slot)
+    {
+        if (slot == count)
+        {
+            LISP_FAIL("not enough arguments to bind %s\n", repr(car(vars)));
+        }
+        frame_set(frame, slot, vals[slot]);
+    }
+
+    if (vars == nil)
+    {
+        if (slot == 0 && count > 0)
+        {
+            LISP_FAIL("no more parameters to bind\n");
+        }
+        return;
+    }
+
+    Expr rest = nil;
+    for (U64 i = count; i > slot; --i)
+    {
+        rest = cons(vals[i - 1], rest);
+    }
+    if (frame_is_var(vars))
+    {
+        frame_set(frame, slot, rest);
+    }
+    else
+    {
+        for (; slot > 0; --slot)
+        {
+            rest = cons(vals[slot - 1], rest);
+        }
+        frame_bind(frame, params, rest);
+    }
+}
+
+#endif
+
+#ifdef LISP_NAMESPACE
+}
+#endif
+
+#line 2 "src/env.impl"
+#ifdef LISP_NAMESPACE
+namespace LISP_NAMESPACE {
+#endif
+
+#define LISP_ENV_UNBOUND make_expr(TYPE_NIL, 1)
+
+/* the root env keeps the id of its value cells in place of <outer>, so
+   symbols bound at the root are looked up by index, other vars (gensyms,
+   keywords) stay in its frame like in any other env
+
+   the call frames of analyzed closures are envs too, their vars are
+   looked up by name in the frame's names */
+
+struct EnvBinding
+{
+    Expr vals;
+    Expr frame;
+    U64 slot;
+    Expr * cell;
+};
+
+class EnvImpl
 {
 public:
     Expr make(Expr outer)
     {
         // ((<vars> . <vals>) . <outer>)
         // TODO add dummy conses as sentinels for vars and vals
-        return cons(cons(nil, nil), outer);
+        if (outer)
+        {
+            return cons(cons(nil, nil), outer);
+        }
+
+        U64 id;
+        if (m_free.empty())
+        {
+            id = (U64) m_cells.size();
+            m_cells.push_back(std::vector<Expr>());
+            m_owners.push_back(nil);
+        }
+        else
+        {
+            id = m_free.back();
+            m_free.pop_back();
+        }
+        Expr const env = cons(cons(nil, nil), make_fixnum(id));
+        m_owners[id] = env;
+        return env;
     }
 
     Expr get_vars(Expr env)
     {
-        return caar(env);
+        Expr const pair = get_pair(env);
+        return pair ? car(pair) : nil;
     }
 
     void set_vars(Expr env, Expr vars)
     {
-        rplaca(car(env), vars);
+        rplaca(make_pair(env), vars);
     }
 
     Expr get_vals(Expr env)
     {
-        return cdar(env);
+        Expr const pair = get_pair(env);
+        return pair ? cdr(pair) : nil;
     }
 
     void set_vals(Expr env, Expr vals)
     {
-        rplacd(car(env), vals);
+        rplacd(make_pair(env), vals);
     }
 
     Expr get_outer(Expr env)
     {
-        return cdr(env);
+        if (is_frame(env))
+        {
+            return frame_outer(env);
+        }
+        Expr const outer = cdr(env);
+        return is_fixnum(outer) ? nil : outer;
     }
 
     void def(Expr env, Expr var, Expr val)
     {
+        U64 slot;
+        if (find_slot(env, var, slot))
+        {
+            rebound(var, frame_get(env, slot), val);
+            frame_set(env, slot, val);
+            return;
+        }
+
+        if (is_cell(env, var))
+        {
+            std::vector<Expr> & cells = get_cells(env);
+            U64 const index = expr_data(var);
+            if (index >= (U64) cells.size())
+            {
+                cells.resize(index + 1, LISP_ENV_UNBOUND);
+            }
+            rebound(var, cells[index], val);
+            cells[index] = val;
+            return;
+        }
+
         Expr const vals = find_local(env, var);
         if (vals)
         {
+            rebound(var, car(vals), val);
             rplaca(vals, val);
         }
         else
         {
+            rebound(var, LISP_ENV_UNBOUND, val);
             set_vars(env, cons(var, get_vars(env)));
             set_vals(env, cons(val, get_vals(env)));
         }
@@ -3843,6 +6235,24 @@ public:
 
     void del(Expr env, Expr var)
     {
+        if (is_cell(env, var))
+        {
+            Expr * cell = find_cell(env, var);
+            if (cell)
+            {
+                rebound(var, *cell, LISP_ENV_UNBOUND);
+                *cell = LISP_ENV_UNBOUND;
+                return;
+            }
+            LISP_FAIL("unbound variable %s\n", repr(var));
+        }
+
+        U64 slot;
+        if (find_slot(env, var, slot))
+        {
+            LISP_FAIL("cannot delete argument %s\n", repr(var));
+        }
+
         Expr prev_vars = nil;
         Expr prev_vals = nil;
 
@@ -3852,6 +6262,7 @@ public:
         {
             if (car(vars) == var)
             {
+                rebound(var, car(vals), LISP_ENV_UNBOUND);
                 if (prev_vars)
                 {
                     LISP_ASSERT(prev_vals);
@@ -3877,16 +6288,16 @@ public:
 
     bool can_set(Expr env, Expr var)
     {
-        Expr const tmp = find_global(env, var);
-        return tmp != nil;
+        EnvBinding binding;
+        return find_global(env, var, binding);
     }
 
     Expr get(Expr env, Expr var)
     {
-        Expr const vals = find_global(env, var);
-        if (vals)
+        EnvBinding binding;
+        if (find_global(env, var, binding))
         {
-            return car(vals);
+            return load(binding);
         }
         else
         {
@@ -3897,10 +6308,10 @@ public:
 
     void set(Expr env, Expr var, Expr val)
     {
-        Expr const vals = find_global(env, var);
-        if (vals)
+        EnvBinding binding;
+        if (find_global(env, var, binding))
         {
-            rplaca(vals, val);
+            store(binding, var, val);
         }
         else
         {
@@ -3908,56 +6319,243 @@ public:
         }
     }
 
-protected:
-    Expr find_local(Expr env, Expr var)
+    /* the value cells are not on the heap, so the collector asks for them */
+
+    template <typename Func>
+    void each_value(Func func)
     {
-        Expr vars = get_vars(env);
-        Expr vals = get_vals(env);
-        while (vars)
+        for (U64 id = 0; id < (U64) m_cells.size(); ++id)
         {
-            if (car(vars) == var)
-            {
-                return vals;
-            }
-            vars = cdr(vars);
-            vals = cdr(vals);
+            each_value(id, func);
         }
-        return nil;
     }
 
-    Expr find_global(Expr env, Expr var)
+    /* visits the cells of the root envs that the predicate says are
+       reachable and that were not visited yet in this collection, returns
+       whether there were any */
+    template <typename Pred, typename Func>
+    bool each_reachable_value(Pred is_reachable, Func func)
     {
-        while (env)
+        if (m_traced.size() != m_cells.size())
         {
-            Expr const vals = find_local(env, var);
-            if (vals)
+            m_traced.resize(m_cells.size(), false);
+        }
+        bool found = false;
+        for (U64 id = 0; id < (U64) m_cells.size(); ++id)
+        {
+            if (!m_traced[id] && m_owners[id] && is_reachable(m_owners[id]))
             {
-                return vals;
+                m_traced[id] = true;
+                each_value(id, func);
+                found = true;
             }
-            else
+        }
+        return found;
+    }
+
+    /* drops the cells of unreachable root envs */
+    template <typename Pred>
+    void sweep(Pred is_reachable)
+    {
+        for (U64 id = 0; id < (U64) m_cells.size(); ++id)
+        {
+            if (m_owners[id] && !is_reachable(m_owners[id]))
             {
-                env = get_outer(env);
+                m_owners[id] = nil;
+                std::vector<Expr>().swap(m_cells[id]);
+                m_free.push_back(id);
             }
         }
-        return nil;
+        m_traced.assign(m_cells.size(), false);
     }
-};
 
-#if LISP_WANT_GLOBAL_API
+protected:
+    bool is_root(Expr env)
+    {
+        return is_cons(env) && is_fixnum(cdr(env));
+    }
 
-EnvImpl g_env;
+    Expr get_pair(Expr env)
+    {
+        return is_frame(env) ? frame_extra(env) : car(env);
+    }
 
-Expr make_env(Expr outer)
-{
-    return g_env.make(outer);
-}
+    Expr make_pair(Expr env)
+    {
+        if (is_frame(env) && !frame_extra(env))
+        {
+            frame_set_extra(env, cons(nil, nil));
+        }
+        return get_pair(env);
+    }
 
-void env_def(Expr env, Expr var, Expr val)
-{
-    g_env.def(env, var, val);
-}
+    bool find_slot(Expr env, Expr var, U64 & slot)
+    {
+        if (!is_frame(env))
+        {
+            return false;
+        }
+        slot = 0;
+        for (Expr names = frame_names(env); names; names = cdr(names), ++slot)
+        {
+            if (car(names) == var)
+            {
+                return true;
+            }
+        }
+        return false;
+    }
 
-void env_del(Expr env, Expr var)
+    bool is_cell(Expr env, Expr var)
+    {
+        return is_symbol(var) && is_root(env);
+    }
+
+    std::vector<Expr> & get_cells(Expr env)
+    {
+        U64 const id = (U64) fixnum_value(cdr(env));
+        LISP_ASSERT(id < (U64) m_cells.size() && m_owners[id] == env);
+        return m_cells[id];
+    }
+
+    Expr * find_cell(Expr env, Expr var)
+    {
+        std::vector<Expr> & cells = get_cells(env);
+        U64 const index = expr_data(var);
+        if (index < (U64) cells.size() && cells[index] != LISP_ENV_UNBOUND)
+        {
+            return &cells[index];
+        }
+        return NULL;
+    }
+
+    template <typename Func>
+    void each_value(U64 id, Func func)
+    {
+        for (auto val : m_cells[id])
+        {
+            if (val != LISP_ENV_UNBOUND)
+            {
+                func(val);
+            }
+        }
+    }
+
+    Expr find_local(Expr env, Expr var)
+    {
+        Expr vars = get_vars(env);
+        Expr vals = get_vals(env);
+        while (vars)
+        {
+            if (car(vars) == var)
+            {
+                return vals;
+            }
+            vars = cdr(vars);
+            vals = cdr(vals);
+        }
+        return nil;
+    }
+
+    bool find_global(Expr env, Expr var, EnvBinding & binding)
+    {
+        binding.vals = nil;
+        binding.frame = nil;
+        binding.cell = NULL;
+        while (env)
+        {
+            if (is_cell(env, var))
+            {
+                binding.cell = find_cell(env, var);
+                return binding.cell != NULL;
+            }
+
+            if (find_slot(env, var, binding.slot))
+            {
+                binding.frame = env;
+                return true;
+            }
+
+            Expr const vals = find_local(env, var);
+            if (vals)
+            {
+                binding.vals = vals;
+                return true;
+            }
+            else
+            {
+                env = get_outer(env);
+            }
+        }
+        return false;
+    }
+
+    Expr load(EnvBinding const & binding)
+    {
+        if (binding.cell)
+        {
+            return *binding.cell;
+        }
+        else if (binding.frame)
+        {
+            return frame_get(binding.frame, binding.slot);
+        }
+        else
+        {
+            return car(binding.vals);
+        }
+    }
+
+    /* expansions of a macro that is no longer bound here are likely dead,
+       and so is code that was analyzed with what var was bound to */
+    void rebound(Expr var, Expr old, Expr val)
+    {
+        if (is_macro(old))
+        {
+            forget_macro(old);
+        }
+        forget_analyses(var, val);
+    }
+
+    void store(EnvBinding const & binding, Expr var, Expr val)
+    {
+        rebound(var, load(binding), val);
+        if (binding.cell)
+        {
+            *binding.cell = val;
+        }
+        else if (binding.frame)
+        {
+            frame_set(binding.frame, binding.slot, val);
+        }
+        else
+        {
+            rplaca(binding.vals, val);
+        }
+    }
+
+private:
+    std::vector<std::vector<Expr>> m_cells;
+    std::vector<Expr> m_owners;
+    std::vector<U64> m_free;
+    std::vector<bool> m_traced;
+};
+
+#if LISP_WANT_GLOBAL_API
+
+EnvImpl g_env;
+
+Expr make_env(Expr outer)
+{
+    return g_env.make(outer);
+}
+
+void env_def(Expr env, Expr var, Expr val)
+{
+    g_env.def(env, var, val);
+}
+
+void env_del(Expr env, Expr var)
 {
     g_env.del(env, var);
 }
@@ -3983,98 +6581,3751 @@ void env_set(Expr env, Expr var, Expr val)
 }
 #endif
 
-#line 2 "src/eval.impl"
+#line 2 "src/macro.impl"
 #ifdef LISP_NAMESPACE
 namespace LISP_NAMESPACE {
 #endif
 
-class EvalImpl
-{
-public:
-    Expr eval(Expr exp, Expr env)
+struct MacroEntry
+{
+    Expr mac;
+    Expr expansion;
+    bool traced;
+};
+
+/* expansions are memoized per call site, keyed by the cons of the call
+   form, which is part of the code and so unique to it even when its args
+   are not, and the macro, so that a call site that sees a new macro
+   after a redefinition expands again, the entries of a macro that is
+   redefined are dropped right away, the env drops the analyzed code and
+   programs that inlined its expansions at the same time, see
+   forget_analyses */
+
+class MacroImpl
+{
+public:
+    MacroImpl() : m_hits(0), m_misses(0), m_runtime_us(0), m_ahead_us(0), m_timing(false), m_expand_on_load(false), m_heads(nullptr)
+    {
+    }
+
+    Expr expand(Expr mac, Expr call)
+    {
+        LISP_ASSERT(is_macro(mac));
+        LISP_ASSERT(is_cons(call));
+        auto const range = m_cache.equal_range(call);
+        for (auto it = range.first; it != range.second; ++it)
+        {
+            if (it->second.mac == mac)
+            {
+                ++m_hits;
+                return it->second.expansion;
+            }
+        }
+
+        ++m_misses;
+        MacroEntry entry;
+        entry.mac = mac;
+        {
+            Timer const timer(*this, m_runtime_us);
+            entry.expansion = call_closure(mac, cdr(call));
+        }
+        entry.traced = false;
+        m_cache.insert(std::make_pair(call, entry));
+        return entry.expansion;
+    }
+
+    /* expansions done ahead of time are not memoized, the expanded code
+       takes the place of the call */
+
+    Expr macroexpand_1(Expr exp, Expr env)
+    {
+        Expr mac;
+        if (!find_macro(exp, env, nil, mac))
+        {
+            return exp;
+        }
+        Timer const timer(*this, m_ahead_us);
+        return call_closure(mac, cdr(exp));
+    }
+
+    Expr macroexpand(Expr exp, Expr env)
+    {
+        GcRoot const exp_root(exp);
+        Expr mac;
+        while (find_macro(exp, env, nil, mac))
+        {
+            Timer const timer(*this, m_ahead_us);
+            exp = call_closure(mac, cdr(exp));
+        }
+        return exp;
+    }
+
+    Expr macroexpand_all(Expr exp, Expr env)
+    {
+        Timer const timer(*this, m_ahead_us);
+        return expand_all(exp, env, nil);
+    }
+
+    /* also adds the globals it looked up to heads, whatever they were */
+    Expr macroexpand_all_noting(Expr exp, Expr env, std::vector<Expr> & heads)
+    {
+        Noting const noting(*this, heads);
+        return macroexpand_all(exp, env);
+    }
+
+    void forget(Expr mac)
+    {
+        for (auto it = m_cache.begin(); it != m_cache.end();)
+        {
+            if (it->second.mac == mac)
+            {
+                it = m_cache.erase(it);
+            }
+            else
+            {
+                ++it;
+            }
+        }
+    }
+
+    /* the cache does not keep call sites or macros alive, see
+       GcImpl::trace_weak */
+
+    template <typename Func>
+    void each_value(Func func)
+    {
+        for (auto & it : m_cache)
+        {
+            func(it.second.expansion);
+        }
+    }
+
+    template <typename Pred, typename Func>
+    bool each_reachable_value(Pred is_reachable, Func func)
+    {
+        bool found = false;
+        for (auto & it : m_cache)
+        {
+            if (!it.second.traced && is_reachable(it.first) && is_reachable(it.second.mac))
+            {
+                it.second.traced = true;
+                func(it.second.expansion);
+                found = true;
+            }
+        }
+        return found;
+    }
+
+    template <typename Pred>
+    void sweep(Pred is_reachable)
+    {
+        for (auto it = m_cache.begin(); it != m_cache.end();)
+        {
+            if (is_reachable(it->first) && is_reachable(it->second.mac))
+            {
+                it->second.traced = false;
+                ++it;
+            }
+            else
+            {
+                it = m_cache.erase(it);
+            }
+        }
+    }
+
+    U64 hits() const
+    {
+        return m_hits;
+    }
+
+    U64 misses() const
+    {
+        return m_misses;
+    }
+
+    bool expand_on_load() const
+    {
+        return m_expand_on_load;
+    }
+
+    void set_expand_on_load(bool value)
+    {
+        m_expand_on_load = value;
+    }
+
+    void print_stats(FILE * file)
+    {
+        fprintf(file, "macro: %" PRIu64 " hit(s), %" PRIu64 " miss(es), %" PRIu64 " cached expansion(s)\n",
+                m_hits, m_misses, (U64) m_cache.size());
+        fprintf(file, "macro: %.3f ms expanding at runtime, %.3f ms ahead of time\n",
+                m_runtime_us / 1e3, m_ahead_us / 1e3);
+    }
+
+protected:
+    /* only the outermost expansion is timed, as macros expand others */
+    class Timer
+    {
+    public:
+        Timer(MacroImpl & macro, U64 & total) : m_macro(macro), m_total(total), m_outer(!macro.m_timing)
+        {
+            if (m_outer)
+            {
+                m_macro.m_timing = true;
+                m_start = std::chrono::steady_clock::now();
+            }
+        }
+
+        ~Timer()
+        {
+            if (m_outer)
+            {
+                auto const delta = std::chrono::steady_clock::now() - m_start;
+                m_total += (U64) std::chrono::duration_cast<std::chrono::microseconds>(delta).count();
+                m_macro.m_timing = false;
+            }
+        }
+
+    private:
+        MacroImpl & m_macro;
+        U64 & m_total;
+        bool const m_outer;
+        std::chrono::steady_clock::time_point m_start;
+    };
+
+    class Noting
+    {
+    public:
+        Noting(MacroImpl & macro, std::vector<Expr> & heads) : m_macro(macro), m_outer(macro.m_heads)
+        {
+            m_macro.m_heads = &heads;
+        }
+
+        ~Noting()
+        {
+            m_macro.m_heads = m_outer;
+        }
+
+    private:
+        MacroImpl & m_macro;
+        std::vector<Expr> * const m_outer;
+    };
+
+    bool is_var(Expr exp)
+    {
+#if LISP_WANT_GENSYM
+        return is_symbol(exp) || is_gensym(exp);
+#else
+        return is_symbol(exp);
+#endif
+    }
+
+    bool is_bound(Expr var, Expr bound)
+    {
+        for (; bound; bound = cdr(bound))
+        {
+            if (car(bound) == var)
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    /* a global the form calls by name, unless a local shadows it */
+    bool find_global(Expr exp, Expr env, Expr bound, Expr & val)
+    {
+        if (!is_cons(exp))
+        {
+            return false;
+        }
+        Expr const head = car(exp);
+        if (!is_var(head) || is_bound(head, bound))
+        {
+            return false;
+        }
+        if (m_heads)
+        {
+            m_heads->push_back(head);
+        }
+        if (!env_can_set(env, head))
+        {
+            return false;
+        }
+        val = env_get(env, head);
+        return true;
+    }
+
+    bool find_macro(Expr exp, Expr env, Expr bound, Expr & mac)
+    {
+        return find_global(exp, env, bound, mac) && is_macro(mac);
+    }
+
+    void bind(Expr vars, Expr & bound)
+    {
+        if (vars == nil)
+        {
+            return;
+        }
+        else if (is_cons(vars))
+        {
+            for (; is_cons(vars); vars = cdr(vars))
+            {
+                bind(car(vars), bound);
+            }
+            bind(vars, bound);
+        }
+        else
+        {
+            bound = cons(vars, bound);
+        }
+    }
+
+    /* walks the code like the evaluator would, forms under a special this
+       does not know are left to be expanded when they run */
+    Expr expand_all(Expr exp, Expr env, Expr bound)
+    {
+        if (eval_stack_low())
+        {
+            return eval_on_new_stack([&]() { return expand_all(exp, env, bound); });
+        }
+        EvalGuard const guard;
+        GcRoot const exp_root(exp);
+        GcRoot const bound_root(bound);
+
+        Expr val;
+        while (find_macro(exp, env, bound, val))
+        {
+            exp = call_closure(val, cdr(exp));
+        }
+        if (!is_cons(exp))
+        {
+            return exp;
+        }
+        else if (!find_global(exp, env, bound, val) || !is_builtin_special(val))
+        {
+            return expand_list(exp, env, bound);
+        }
+
+        Expr const head = car(exp);
+        Expr const args = cdr(exp);
+        U64 const kind = builtin_special_kind(val);
+        switch (kind)
+        {
+        case SPECIAL_IF:
+        case SPECIAL_WHILE:
+        case SPECIAL_PROGN:
+        case SPECIAL_WHEN:
+        case SPECIAL_UNLESS:
+        case SPECIAL_AND:
+        case SPECIAL_OR:
+            return cons(head, expand_list(args, env, bound));
+        case SPECIAL_COND:
+        {
+            Expr ret = nil;
+            GcRoot const ret_root(ret);
+            Expr clauses = args;
+            for (; is_cons(clauses); clauses = cdr(clauses))
+            {
+                ret = cons(expand_list(car(clauses), env, bound), ret);
+            }
+            return cons(head, nreverse_onto(ret, clauses));
+        }
+        default:
+            break;
+        }
+
+        if (!is_cons(args))
+        {
+            return exp;
+        }
+        switch (kind)
+        {
+        case SPECIAL_LET:
+        case SPECIAL_LET_STAR:
+        {
+            Expr const decls = expand_decls(car(args), env, bound, kind == SPECIAL_LET_STAR);
+            GcRoot const decls_root(decls);
+            for (Expr tmp = decls; is_cons(tmp); tmp = cdr(tmp))
+            {
+                bind(is_cons(car(tmp)) ? caar(tmp) : car(tmp), bound);
+            }
+            return cons(head, cons(decls, expand_list(cdr(args), env, bound)));
+        }
+        case SPECIAL_LAMBDA:
+        case SPECIAL_SYNTAX:
+            bind(car(args), bound);
+            return cons(head, cons(car(args), expand_list(cdr(args), env, bound)));
+        case SPECIAL_DEF:
+            return cons(head, cons(car(args), expand_list(cdr(args), env, bound)));
+        case SPECIAL_BACKQUOTE:
+        {
+            Expr const tmp = expand_template(car(args), env, bound);
+            GcRoot const tmp_root(tmp);
+            return cons(head, cons(tmp, cdr(args)));
+        }
+        default:
+            return exp;
+        }
+    }
+
+    Expr expand_list(Expr exps, Expr env, Expr bound)
+    {
+        Expr ret = nil;
+        GcRoot const ret_root(ret);
+        for (; is_cons(exps); exps = cdr(exps))
+        {
+            ret = cons(expand_all(car(exps), env, bound), ret);
+        }
+        return nreverse_onto(ret, exps);
+    }
+
+    /* the inits of a let* see the vars bound before them */
+    Expr expand_decls(Expr decls, Expr env, Expr bound, bool sequential)
+    {
+        GcRoot const bound_root(bound);
+        Expr ret = nil;
+        GcRoot const ret_root(ret);
+        for (; is_cons(decls); decls = cdr(decls))
+        {
+            Expr const decl = car(decls);
+            if (!is_cons(decl))
+            {
+                ret = cons(decl, ret);
+                continue;
+            }
+            Expr const inits = expand_list(cdr(decl), env, bound);
+            ret = cons(cons(car(decl), inits), ret);
+            if (sequential)
+            {
+                bind(car(decl), bound);
+            }
+        }
+        return nreverse_onto(ret, decls);
+    }
+
+    /* follows backquote(), only what gets evaluated is expanded */
+    Expr expand_template(Expr exp, Expr env, Expr bound)
+    {
+        if (!is_cons(exp))
+        {
+            return exp;
+        }
+        else if (is_unquote(exp) || is_unquote_splicing(exp))
+        {
+            if (!is_cons(cdr(exp)))
+            {
+                return exp;
+            }
+            Expr const tmp = expand_all(cadr(exp), env, bound);
+            GcRoot const tmp_root(tmp);
+            return cons(car(exp), cons(tmp, cddr(exp)));
+        }
+
+        Expr ret = nil;
+        GcRoot const ret_root(ret);
+        Expr seq = exp;
+        for (; is_cons(seq); seq = cdr(seq))
+        {
+            ret = cons(expand_template(car(seq), env, bound), ret);
+        }
+        return nreverse_onto(ret, seq);
+    }
+
+    Expr nreverse_onto(Expr list, Expr tail)
+    {
+        while (list)
+        {
+            Expr const next = cdr(list);
+            set_cdr(list, tail);
+            tail = list;
+            list = next;
+        }
+        return tail;
+    }
+
+private:
+    std::unordered_multimap<Expr, MacroEntry> m_cache;
+    U64 m_hits;
+    U64 m_misses;
+    U64 m_runtime_us;
+    U64 m_ahead_us;
+    bool m_timing;
+    bool m_expand_on_load;
+    std::vector<Expr> * m_heads;
+};
+
+#if LISP_WANT_GLOBAL_API
+
+MacroImpl g_macro;
+
+Expr expand_macro(Expr mac, Expr call)
+{
+    return g_macro.expand(mac, call);
+}
+
+Expr macroexpand_1(Expr exp, Expr env)
+{
+    return g_macro.macroexpand_1(exp, env);
+}
+
+Expr macroexpand(Expr exp, Expr env)
+{
+    return g_macro.macroexpand(exp, env);
+}
+
+Expr macroexpand_all(Expr exp, Expr env)
+{
+    return g_macro.macroexpand_all(exp, env);
+}
+
+Expr macroexpand_all_noting(Expr exp, Expr env, std::vector<Expr> & heads)
+{
+    return g_macro.macroexpand_all_noting(exp, env, heads);
+}
+
+bool macro_expand_on_load()
+{
+    return g_macro.expand_on_load();
+}
+
+void macro_set_expand_on_load(bool value)
+{
+    g_macro.set_expand_on_load(value);
+}
+
+void forget_macro(Expr mac)
+{
+    g_macro.forget(mac);
+}
+
+U64 macro_cache_hits()
+{
+    return g_macro.hits();
+}
+
+U64 macro_cache_misses()
+{
+    return g_macro.misses();
+}
+
+void macro_print_stats(FILE * file)
+{
+    g_macro.print_stats(file);
+}
+
+#endif
+
+#ifdef LISP_NAMESPACE
+}
+#endif
+
+#line 2 "src/analyze.impl"
+#ifdef LISP_NAMESPACE
+namespace LISP_NAMESPACE {
+#endif
+
+#define LISP_LOCAL_REF_SLOT_BITS UINT64_C(32)
+#define LISP_GLOBAL_REF_VAR_BITS UINT64_C(40)
+
+Expr make_local_ref(U64 depth, U64 slot)
+{
+    LISP_ASSERT(slot >> LISP_LOCAL_REF_SLOT_BITS == 0);
+    LISP_ASSERT(depth >> (LISP_DATA_BITS - LISP_LOCAL_REF_SLOT_BITS) == 0);
+    return make_expr(TYPE_LOCAL_REF, (depth << LISP_LOCAL_REF_SLOT_BITS) | slot);
+}
+
+U64 local_ref_depth(Expr exp)
+{
+    LISP_ASSERT_DEBUG(expr_type(exp) == TYPE_LOCAL_REF);
+    return expr_data(exp) >> LISP_LOCAL_REF_SLOT_BITS;
+}
+
+U64 local_ref_slot(Expr exp)
+{
+    LISP_ASSERT_DEBUG(expr_type(exp) == TYPE_LOCAL_REF);
+    return expr_data(exp) & ((UINT64_C(1) << LISP_LOCAL_REF_SLOT_BITS) - 1);
+}
+
+Expr make_global_ref(U64 depth, Expr var)
+{
+    LISP_ASSERT(is_symbol(var));
+    U64 const index = expr_data(var);
+    LISP_ASSERT(index >> LISP_GLOBAL_REF_VAR_BITS == 0);
+    LISP_ASSERT(depth >> (LISP_DATA_BITS - LISP_GLOBAL_REF_VAR_BITS) == 0);
+    return make_expr(TYPE_GLOBAL_REF, (depth << LISP_GLOBAL_REF_VAR_BITS) | index);
+}
+
+U64 global_ref_depth(Expr exp)
+{
+    LISP_ASSERT_DEBUG(expr_type(exp) == TYPE_GLOBAL_REF);
+    return expr_data(exp) >> LISP_GLOBAL_REF_VAR_BITS;
+}
+
+Expr global_ref_var(Expr exp)
+{
+    LISP_ASSERT_DEBUG(expr_type(exp) == TYPE_GLOBAL_REF);
+    return make_expr(TYPE_SYMBOL, expr_data(exp) & ((UINT64_C(1) << LISP_GLOBAL_REF_VAR_BITS) - 1));
+}
+
+struct AnalysisEntry
+{
+    Analysis analysis;
+    bool traced;
+};
+
+/* a body whose analysis looked up a global, and the value it saw if that
+   is what the analysis depends on, a macro, special or builtin symbol */
+struct AnalysisDep
+{
+    Expr body;
+    Expr seen;
+};
+
+/* a closure is analyzed at its first call, macros are expanded then, and
+   the result is cached by body for all closures made from the same
+   lambda in the same scope, entries stay put until their body dies, as
+   engines keep pointers into them while running
+
+   a body that defs new names, or uses *env*, with or a special that is
+   not known here, is left alone and evaluated in a cons env
+
+   rebinding a global that an analysis looked up to or from a macro,
+   special or builtin symbol makes the analysis stale, it is left for
+   whatever runs it and skipped from then on, until nothing runs any
+   more and it can be dropped */
+
+class AnalyzeImpl
+{
+public:
+    Analysis * analyze(Expr exp)
+    {
+        Expr const args = closure_args(exp);
+        Expr const body = closure_body(exp);
+        Expr const env = closure_env(exp);
+
+        auto const range = m_cache.equal_range(body);
+        for (auto it = range.first; it != range.second; ++it)
+        {
+            Analysis & analysis = it->second.analysis;
+            if (!analysis.stale && analysis.args == args && in_scope(analysis, env))
+            {
+                return &analysis;
+            }
+        }
+
+        AnalysisEntry entry;
+        entry.traced = false;
+        Context ctx;
+        build(ctx, entry.analysis, args, body, env);
+        if (!entry.analysis.dynamic)
+        {
+            depend(ctx, body);
+        }
+
+        auto const it = m_cache.insert(std::make_pair(body, entry));
+        return &it->second.analysis;
+    }
+
+    /* var is now bound to val somewhere, which only matters to analyses
+       that saw something else there than a value they depend on */
+    void forget(Expr var, Expr val)
+    {
+        auto const found = m_deps.find(var);
+        if (found == m_deps.end())
+        {
+            return;
+        }
+        Expr const seen = depended_on(val) ? val : nil;
+        std::vector<AnalysisDep> & deps = found->second;
+        for (size_t i = 0; i < deps.size();)
+        {
+            if (deps[i].seen != seen)
+            {
+                invalidate(deps[i].body);
+                deps[i] = deps.back();
+                deps.pop_back();
+            }
+            else
+            {
+                ++i;
+            }
+        }
+        if (deps.empty())
+        {
+            m_deps.erase(found);
+        }
+    }
+
+    /* only when no evaluation is running, engines that cached a pointer
+       to one of these see the epoch change */
+    void drop_stale()
+    {
+        if (!m_stale)
+        {
+            return;
+        }
+        for (auto it = m_cache.begin(); it != m_cache.end();)
+        {
+            if (it->second.analysis.stale)
+            {
+                it = m_cache.erase(it);
+            }
+            else
+            {
+                ++it;
+            }
+        }
+        m_stale = 0;
+        gc_next_epoch();
+    }
+
+    U64 cached() const
+    {
+        return (U64) m_cache.size();
+    }
+
+    /* the cache does not keep bodies alive, see GcImpl::collect */
+
+    template <typename Func>
+    void each_value(Func func)
+    {
+        for (auto & it : m_cache)
+        {
+            each_value(it.second.analysis, func);
+        }
+    }
+
+    template <typename Pred, typename Func>
+    bool each_reachable_value(Pred is_reachable, Func func)
+    {
+        bool found = false;
+        for (auto & it : m_cache)
+        {
+            if (!it.second.traced && is_reachable(it.first))
+            {
+                it.second.traced = true;
+                each_value(it.second.analysis, func);
+                found = true;
+            }
+        }
+        return found;
+    }
+
+    template <typename Pred>
+    void sweep(Pred is_reachable)
+    {
+        for (auto it = m_cache.begin(); it != m_cache.end();)
+        {
+            if (is_reachable(it->first))
+            {
+                it->second.traced = false;
+                ++it;
+            }
+            else
+            {
+                it = m_cache.erase(it);
+            }
+        }
+
+        /* a value seen that died went with the env that bound it */
+        for (auto it = m_deps.begin(); it != m_deps.end();)
+        {
+            std::vector<AnalysisDep> & deps = it->second;
+            for (size_t i = 0; i < deps.size();)
+            {
+                if (!is_reachable(deps[i].body) || (deps[i].seen && !is_reachable(deps[i].seen)))
+                {
+                    invalidate(deps[i].body);
+                    deps[i] = deps.back();
+                    deps.pop_back();
+                }
+                else
+                {
+                    ++i;
+                }
+            }
+            it = deps.empty() ? m_deps.erase(it) : std::next(it);
+        }
+    }
+
+protected:
+    struct Context
+    {
+        std::vector<Expr> levels;
+        Expr global;
+        bool dynamic;
+        std::vector<Expr> defined;
+        std::vector<Expr> captured;
+        std::vector<Expr> shared;
+        std::vector<Expr> globals;
+    };
+
+    bool depended_on(Expr val)
+    {
+        return is_builtin_special(val) || is_builtin_symbol(val) || is_macro(val);
+    }
+
+    /* records what the analysis of body saw of the globals it looked up */
+    void depend(Context & ctx, Expr body)
+    {
+        std::sort(ctx.globals.begin(), ctx.globals.end());
+        ctx.globals.erase(std::unique(ctx.globals.begin(), ctx.globals.end()), ctx.globals.end());
+        for (auto var : ctx.globals)
+        {
+            Expr val = nil;
+            if (env_can_set(ctx.global, var))
+            {
+                val = env_get(ctx.global, var);
+            }
+            AnalysisDep dep;
+            dep.body = body;
+            dep.seen = depended_on(val) ? val : nil;
+            m_deps[var].push_back(dep);
+        }
+    }
+
+    void invalidate(Expr body)
+    {
+        auto const range = m_cache.equal_range(body);
+        for (auto it = range.first; it != range.second; ++it)
+        {
+            if (!it->second.analysis.stale)
+            {
+                it->second.analysis.stale = true;
+                ++m_stale;
+            }
+        }
+    }
+
+    template <typename Func>
+    void each_value(Analysis const & analysis, Func func)
+    {
+        func(analysis.args);
+        func(analysis.names);
+        func(analysis.code);
+        for (auto names : analysis.scope)
+        {
+            func(names);
+        }
+    }
+
+    bool in_scope(Analysis const & analysis, Expr env)
+    {
+        for (auto names : analysis.scope)
+        {
+            if (!is_frame(env) || frame_names(env) != names)
+            {
+                return false;
+            }
+            env = frame_outer(env);
+        }
+        return !is_frame(env);
+    }
+
+    void build(Context & ctx, Analysis & analysis, Expr args, Expr body, Expr env)
+    {
+        analysis.args = args;
+        analysis.names = nil;
+        analysis.size = 0;
+        analysis.code = nil;
+        analysis.dynamic = false;
+        analysis.stale = false;
+
+        GcRoot const names_root(analysis.names);
+        GcRoot const code_root(analysis.code);
+
+        flatten(args, analysis.names);
+        analysis.names = nreverse(analysis.names);
+        for (Expr tmp = analysis.names; tmp; tmp = cdr(tmp))
+        {
+            ++analysis.size;
+        }
+
+        ctx.levels.push_back(analysis.names);
+        for (; is_frame(env); env = frame_outer(env))
+        {
+            analysis.scope.push_back(frame_names(env));
+            ctx.levels.push_back(frame_names(env));
+        }
+        ctx.global = env;
+        ctx.dynamic = false;
+
+        analysis.code = analyze_list(ctx, body);
+        if (!ctx.dynamic && share(ctx))
+        {
+            analysis.code = analyze_list(ctx, body);
+        }
+        if (ctx.dynamic)
+        {
+            analysis.code = nil;
+            analysis.dynamic = true;
+        }
+    }
+
+    /* same order as the frame is bound in, see frame_bind */
+    void flatten(Expr vars, Expr & ret)
+    {
+        if (vars == nil)
+        {
+            return;
+        }
+        else if (is_cons(vars))
+        {
+            for (; is_cons(vars); vars = cdr(vars))
+            {
+                flatten(car(vars), ret);
+            }
+            flatten(vars, ret);
+        }
+        else
+        {
+            ret = cons(vars, ret);
+        }
+    }
+
+    bool is_var(Expr exp)
+    {
+#if LISP_WANT_GENSYM
+        return is_symbol(exp) || is_gensym(exp);
+#else
+        return is_symbol(exp);
+#endif
+    }
+
+    bool find_local(Context const & ctx, Expr var, U64 & depth, U64 & slot)
+    {
+        for (depth = 0; depth < (U64) ctx.levels.size(); ++depth)
+        {
+            slot = 0;
+            for (Expr names = ctx.levels[depth]; names; names = cdr(names), ++slot)
+            {
+                if (car(names) == var)
+                {
+                    return true;
+                }
+            }
+        }
+        return false;
+    }
+
+    bool find_global(Context & ctx, Expr var, Expr & val)
+    {
+        ctx.globals.push_back(var);
+        if (env_can_set(ctx.global, var))
+        {
+            val = env_get(ctx.global, var);
+            return true;
+        }
+        return false;
+    }
+
+    Expr fallback(Context & ctx)
+    {
+        ctx.dynamic = true;
+        return nil;
+    }
+
+    Expr analyze(Context & ctx, Expr exp)
+    {
+        if (eval_stack_low())
+        {
+            return eval_on_new_stack([&]() { return analyze(ctx, exp); });
+        }
+        EvalGuard const guard;
+        if (ctx.dynamic)
+        {
+            return nil;
+        }
+        else if (is_var(exp))
+        {
+            return analyze_var(ctx, exp);
+        }
+        else if (is_cons(exp))
+        {
+            return analyze_call(ctx, exp);
+        }
+        else
+        {
+            return exp;
+        }
+    }
+
+    Expr analyze_var(Context & ctx, Expr var)
+    {
+        U64 depth, slot;
+        if (find_local(ctx, var, depth, slot))
+        {
+            return make_local_ref(depth, slot);
+        }
+
+        Expr val;
+        if (find_global(ctx, var, val) && is_builtin_symbol(val))
+        {
+            return fallback(ctx);
+        }
+        return is_symbol(var) ? make_global_ref(ctx.levels.size(), var) : var;
+    }
+
+    Expr analyze_call(Context & ctx, Expr exp)
+    {
+        Expr const head = car(exp);
+        Expr const args = cdr(exp);
+
+        U64 depth, slot;
+        Expr val;
+        if (is_var(head) && !find_local(ctx, head, depth, slot) && find_global(ctx, head, val))
+        {
+            if (is_builtin_special(val))
+            {
+                return analyze_special(ctx, val, args);
+            }
+            else if (is_macro(val))
+            {
+                Expr const expansion = expand_macro(val, exp);
+                GcRoot const expansion_root(expansion);
+                return analyze(ctx, expansion);
+            }
+        }
+
+        /* literal closures are applied as they are */
+        Expr const op = is_function(head) || is_macro(head) ? head : analyze(ctx, head);
+        GcRoot const op_root(op);
+        return cons(op, analyze_list(ctx, args));
+    }
+
+    /* the special itself goes in place of its name */
+    Expr analyze_special(Context & ctx, Expr special, Expr args)
+    {
+        U64 const kind = builtin_special_kind(special);
+        switch (kind)
+        {
+        case SPECIAL_QUOTE:
+        case SPECIAL_SYNTAX:
+            return cons(special, args);
+        case SPECIAL_LAMBDA:
+            return analyze_lambda(ctx, special, args);
+        case SPECIAL_IF:
+        case SPECIAL_WHILE:
+        case SPECIAL_PROGN:
+        case SPECIAL_WHEN:
+        case SPECIAL_UNLESS:
+        case SPECIAL_AND:
+        case SPECIAL_OR:
+            return cons(special, analyze_list(ctx, args));
+        case SPECIAL_COND:
+            return cons(special, analyze_clauses(ctx, args));
+        case SPECIAL_LET:
+        case SPECIAL_LET_STAR:
+            if (!is_cons(args))
+            {
+                return fallback(ctx);
+            }
+            return analyze_let(ctx, car(args), cdr(args), kind == SPECIAL_LET_STAR);
+        case SPECIAL_DEF:
+            if (!is_cons(args) || !is_param(ctx, car(args)))
+            {
+                return fallback(ctx);
+            }
+            ctx.defined.push_back(car(args));
+            return cons(special, cons(car(args), analyze_list(ctx, cdr(args))));
+        case SPECIAL_BACKQUOTE:
+            if (!is_cons(args))
+            {
+                return fallback(ctx);
+            }
+            return cons(special, cons(analyze_template(ctx, car(args)), nil));
+        default:
+            return fallback(ctx);
+        }
+    }
+
+    bool is_param(Context const & ctx, Expr var)
+    {
+        return memq(var, ctx.levels[0]);
+    }
+
+    Expr analyze_list(Context & ctx, Expr exps)
+    {
+        Expr ret = nil;
+        GcRoot const ret_root(ret);
+        for (; exps; exps = cdr(exps))
+        {
+            if (!is_cons(exps))
+            {
+                return fallback(ctx);
+            }
+            ret = cons(analyze(ctx, car(exps)), ret);
+        }
+        return nreverse(ret);
+    }
+
+    Expr analyze_clauses(Context & ctx, Expr clauses)
+    {
+        Expr ret = nil;
+        GcRoot const ret_root(ret);
+        for (; clauses; clauses = cdr(clauses))
+        {
+            if (!is_cons(clauses) || !is_cons(car(clauses)))
+            {
+                return fallback(ctx);
+            }
+            ret = cons(analyze_list(ctx, car(clauses)), ret);
+        }
+        return nreverse(ret);
+    }
+
+    /* a let becomes a frame-let, which binds the analyzed inits in a
+       frame of its own with the vars as names, instead of making and
+       calling a closure, and a let* a frame-let per var */
+    Expr analyze_let(Context & ctx, Expr decls, Expr body, bool sequential)
+    {
+        Expr names = nil;
+        Expr inits = nil;
+        GcRoot const names_root(names);
+        GcRoot const inits_root(inits);
+
+        Expr rest = decls;
+        for (; rest && !(sequential && names); rest = cdr(rest))
+        {
+            if (!is_cons(rest))
+            {
+                return fallback(ctx);
+            }
+            Expr const decl = car(rest);
+            Expr const var = is_cons(decl) ? car(decl) : decl;
+            Expr const init = is_cons(decl) && is_cons(cdr(decl)) ? cadr(decl) : nil;
+            if (!is_var(var) || memq(var, names))
+            {
+                return fallback(ctx);
+            }
+            names = cons(var, names);
+            inits = cons(analyze(ctx, init), inits);
+        }
+        names = nreverse(names);
+        inits = nreverse(inits);
+
+        if (names)
+        {
+            ctx.levels.insert(ctx.levels.begin(), names);
+        }
+        Expr code = rest ? cons(analyze_let(ctx, rest, body, true), nil) : analyze_list(ctx, body);
+        GcRoot const code_root(code);
+        if (names)
+        {
+            ctx.levels.erase(ctx.levels.begin());
+        }
+        return cons(frame_let(), cons(names, cons(inits, code)));
+    }
+
+    /* a lambda becomes a flat-lambda, which copies the values of the
+       locals its body may refer to into a frame of its own right on top
+       of the global env, instead of keeping all the frames around it,
+       so its calls find them one frame out and the frames can die
+
+       def is the only way to change a local and only works in the frame
+       of the local, so a lambda that captures a local that is def'd
+       shares it by keeping the frames, see share() */
+    Expr analyze_lambda(Context & ctx, Expr special, Expr args)
+    {
+        if (!is_cons(args))
+        {
+            return cons(special, args);
+        }
+
+        Expr const expansion = macroexpand_all_noting(cons(intern("lambda"), args), ctx.global, ctx.globals);
+        GcRoot const expansion_root(expansion);
+
+        Expr names = nil;
+        Expr refs = nil;
+        GcRoot const names_root(names);
+        GcRoot const refs_root(refs);
+        if (!capture(ctx, args, false, names, refs) || !capture(ctx, expansion, true, names, refs))
+        {
+            return cons(special, args);
+        }
+        for (Expr tmp = names; tmp; tmp = cdr(tmp))
+        {
+            if (std::find(ctx.shared.begin(), ctx.shared.end(), car(tmp)) != ctx.shared.end())
+            {
+                return cons(special, args);
+            }
+        }
+        for (Expr tmp = names; tmp; tmp = cdr(tmp))
+        {
+            ctx.captured.push_back(car(tmp));
+        }
+
+        Expr const depth = make_number((I64) ctx.levels.size());
+        return cons(flat_lambda(), cons(names, cons(refs, cons(depth, args))));
+    }
+
+    /* adds the locals of ctx that any var in exp names, false if exp may
+       refer to vars in ways only known when it runs, like through a
+       macro that expand_all left alone, when exp is expanded */
+    bool capture(Context & ctx, Expr exp, bool expanded, Expr & names, Expr & refs)
+    {
+        for (; is_cons(exp); exp = cdr(exp))
+        {
+            Expr const head = car(exp);
+            Expr val;
+            if (expanded && is_var(head) && find_global(ctx, head, val) && is_macro(val))
+            {
+                return false;
+            }
+            if (!capture(ctx, head, expanded, names, refs))
+            {
+                return false;
+            }
+        }
+        if (!is_var(exp) || memq(exp, names))
+        {
+            return true;
+        }
+
+        Expr val;
+        U64 depth, slot;
+        if (find_local(ctx, exp, depth, slot))
+        {
+            names = cons(exp, names);
+            refs = cons(make_local_ref(depth, slot), refs);
+        }
+        else if (find_global(ctx, exp, val) && is_builtin_symbol(val))
+        {
+            return false;
+        }
+        return true;
+    }
+
+    /* true if a lambda captured a local that is def'd, in which case
+       the body has to be analyzed again with those locals shared */
+    bool share(Context & ctx)
+    {
+        for (auto var : ctx.captured)
+        {
+            if (std::find(ctx.defined.begin(), ctx.defined.end(), var) != ctx.defined.end())
+            {
+                ctx.shared.push_back(var);
+            }
+        }
+        ctx.defined.clear();
+        ctx.captured.clear();
+        return !ctx.shared.empty();
+    }
+
+    Expr flat_lambda()
+    {
+        if (!m_flat_lambda)
+        {
+            m_flat_lambda = make_builtin_special_kind("flat-lambda", SPECIAL_FLAT_LAMBDA, [](Expr args, Expr env) -> Expr
+            {
+                Expr const names = car(args);
+                Expr const refs = cadr(args);
+                Expr global = env;
+                for (I64 depth = fixnum_value(caddr(args)); depth > 0; --depth)
+                {
+                    global = frame_outer(global);
+                }
+                Expr const lambda = cdddr(args);
+                if (!names)
+                {
+                    return make_function(global, nil, car(lambda), cdr(lambda));
+                }
+
+                U64 size = 0;
+                for (Expr tmp = names; tmp; tmp = cdr(tmp))
+                {
+                    ++size;
+                }
+                Expr const frame = make_frame(names, size, global);
+                GcRoot const frame_root(frame);
+                U64 slot = 0;
+                for (Expr tmp = refs; tmp; tmp = cdr(tmp), ++slot)
+                {
+                    frame_set(frame, slot, eval(car(tmp), env));
+                }
+                return make_function(frame, nil, car(lambda), cdr(lambda));
+            });
+        }
+        return m_flat_lambda;
+    }
+
+    bool memq(Expr var, Expr names)
+    {
+        for (; names; names = cdr(names))
+        {
+            if (car(names) == var)
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    Expr frame_let()
+    {
+        if (!m_frame_let)
+        {
+            m_frame_let = make_builtin_special_kind("frame-let", SPECIAL_FRAME_LET, [](Expr args, Expr env) -> Expr
+            {
+                Expr const frame = make_let_frame(car(args), cadr(args), env);
+                GcRoot const frame_root(frame);
+                return eval_body(cddr(args), frame);
+            });
+        }
+        return m_frame_let;
+    }
+
+    /* follows backquote(), only what gets evaluated is analyzed */
+    Expr analyze_template(Context & ctx, Expr exp)
+    {
+        if (!is_cons(exp))
+        {
+            return exp;
+        }
+        else if (is_unquote(exp))
+        {
+            return list(LISP_SYM_UNQUOTE, analyze(ctx, cadr(exp)));
+        }
+
+        Expr ret = nil;
+        GcRoot const ret_root(ret);
+        for (Expr seq = exp; seq; seq = cdr(seq))
+        {
+            if (!is_cons(seq))
+            {
+                return fallback(ctx);
+            }
+            Expr const item = car(seq);
+            if (is_unquote_splicing(item))
+            {
+                ret = cons(list(LISP_SYM_UNQUOTE_SPLICING, analyze(ctx, cadr(item))), ret);
+            }
+            else
+            {
+                ret = cons(analyze_template(ctx, item), ret);
+            }
+        }
+        return nreverse(ret);
+    }
+
+private:
+    std::unordered_multimap<Expr, AnalysisEntry> m_cache;
+    std::unordered_map<Expr, std::vector<AnalysisDep>> m_deps;
+    U64 m_stale = 0;
+    Expr m_frame_let = nil;
+    Expr m_flat_lambda = nil;
+};
+
+#if LISP_WANT_GLOBAL_API
+
+AnalyzeImpl g_analyze;
+
+Analysis * closure_analysis(Expr exp)
+{
+    return g_analyze.analyze(exp);
+}
+
+void forget_analyses(Expr var, Expr val)
+{
+    g_analyze.forget(var, val);
+}
+
+void drop_stale_analyses()
+{
+    g_analyze.drop_stale();
+}
+
+U64 analyses_cached()
+{
+    return g_analyze.cached();
+}
+
+#endif
+
+#ifdef LISP_NAMESPACE
+}
+#endif
+
+#line 2 "src/vm.impl"
+#ifdef LISP_NAMESPACE
+namespace LISP_NAMESPACE {
+#endif
+
+/* analyzed closure bodies are compiled to a flat program of words and
+   run on a value stack with a stack of call frames of its own, so that a call from one
+   compiled closure to another does not recurse in C++
+
+   calls are compiled as head, CHECK, args, CALL, where CHECK sends a
+   head that turns out to be a special, a macro or anything else odd
+   at run time to apply() with the call as it is, like the tree
+   walker would, and CALL caches the analysis of the last closure it
+   called until the next collection, TAILCALL is CALL in tail position
+   and reuses the call frame of the caller
+
+   a let binds the values of its inits in a frame of its own with ENTER,
+   which becomes the env of the running call until LEAVE */
+
+enum
+{
+    OP_CONST,     /* exp */
+    OP_EVAL,      /* exp */
+    OP_LOCAL,     /* local ref */
+    OP_GLOBAL,    /* global ref */
+    OP_VAR,       /* var */
+    OP_SPECIAL,   /* special args */
+    OP_POP,
+    OP_JUMP,      /* target */
+    OP_JUMPNIL,   /* target */
+    OP_JUMPTRUE,  /* target */
+    OP_ENTER,     /* names size */
+    OP_LEAVE,
+    OP_CHECK,     /* call target */
+    OP_CALL,      /* argc fun analysis epoch */
+    OP_TAILCALL,  /* argc fun analysis epoch */
+    OP_RETURN,
+};
+
+struct VmFrame
+{
+    Expr fun;
+    U64 * code;
+    U64 pc;
+    Expr env;
+};
+
+class VmImpl
+{
+public:
+    Expr call(Expr fun, Analysis * analysis, Expr vals)
+    {
+        LISP_ASSERT(!analysis->dynamic);
+        GcRoot const fun_root(fun);
+        GcRoot const vals_root(vals);
+
+        U64 * code = program(analysis);
+        Expr const frame = make_frame(analysis->names, analysis->size, closure_env(fun));
+        GcRoot const frame_root(frame);
+        frame_bind(frame, closure_args(fun), vals);
+        return run(fun, code, frame);
+    }
+
+    /* what is below the floors has not changed since the last collection
+       and was promoted by it, so a minor collection can skip it */
+    template <typename Func>
+    void each_root(Func func, bool young_only)
+    {
+        for (size_t i = young_only ? m_stack_floor : 0; i < m_stack.size(); ++i)
+        {
+            func(m_stack[i]);
+        }
+        for (size_t i = young_only ? m_frames_floor : 0; i < m_frames.size(); ++i)
+        {
+            func(m_frames[i].fun);
+            func(m_frames[i].env);
+        }
+        m_stack_floor = m_stack.size();
+        m_frames_floor = m_frames.size();
+    }
+
+protected:
+    /* drops whatever a failed run left on the stacks */
+    class Unwind
+    {
+    public:
+        Unwind(VmImpl & vm) : m_vm(vm), m_stack(vm.m_stack.size()), m_frames(vm.m_frames.size())
+        {
+        }
+
+        ~Unwind()
+        {
+            m_vm.truncate(m_stack);
+            m_vm.m_frames.resize(m_frames);
+            m_vm.m_frames_floor = std::min(m_vm.m_frames_floor, m_frames);
+        }
+
+    private:
+        VmImpl & m_vm;
+        size_t m_stack;
+        size_t m_frames;
+    };
+
+    Expr run(Expr fun, U64 * code, Expr env)
+    {
+        if (eval_stack_low())
+        {
+            return eval_on_new_stack([&]() { return run(fun, code, env); });
+        }
+        EvalGuard const guard;
+        Unwind const unwind(*this);
+        size_t const base = m_frames.size();
+        m_frames.push_back({ fun, code, 0, env });
+
+        U64 pc = 0;
+        for (;;)
+        {
+            switch (code[pc++])
+            {
+            case OP_CONST:
+                m_stack.push_back(code[pc++]);
+                break;
+            case OP_EVAL:
+                m_stack.push_back(eval(code[pc++], env));
+                break;
+            case OP_LOCAL:
+            {
+                Expr const ref = code[pc++];
+                m_stack.push_back(frame_get(outer_frame(env, local_ref_depth(ref)), local_ref_slot(ref)));
+                break;
+            }
+            case OP_GLOBAL:
+            {
+                Expr const ref = code[pc++];
+                m_stack.push_back(env_get(outer_frame(env, global_ref_depth(ref)), global_ref_var(ref)));
+                break;
+            }
+            case OP_VAR:
+                m_stack.push_back(env_get(env, code[pc++]));
+                break;
+            case OP_SPECIAL:
+            {
+                Expr const special = code[pc++];
+                Expr const args = code[pc++];
+                m_stack.push_back(builtin_func(special)(args, env));
+                break;
+            }
+            case OP_POP:
+                pop();
+                break;
+            case OP_JUMP:
+                pc = code[pc];
+                break;
+            case OP_JUMPNIL:
+            {
+                Expr const test = m_stack.back();
+                pop();
+                pc = test ? pc + 1 : code[pc];
+                break;
+            }
+            case OP_JUMPTRUE:
+            {
+                if (m_stack.back())
+                {
+                    pc = code[pc];
+                }
+                else
+                {
+                    pop();
+                    ++pc;
+                }
+                break;
+            }
+            case OP_ENTER:
+            {
+                U64 const size = code[pc + 1];
+                U64 const top = m_stack.size() - size;
+                env = make_frame(code[pc], size, env);
+                for (U64 slot = 0; slot < size; ++slot)
+                {
+                    frame_set(env, slot, m_stack[top + slot]);
+                }
+                truncate(top);
+                set_env(env);
+                pc += 2;
+                break;
+            }
+            case OP_LEAVE:
+                env = frame_outer(env);
+                set_env(env);
+                break;
+            case OP_CHECK:
+            {
+                Expr const head = m_stack.back();
+                if (is_builtin_function(head) || is_function(head))
+                {
+                    pc += 2;
+                }
+                else
+                {
+                    pop();
+                    m_stack.push_back(apply(head, code[pc], env));
+                    pc = code[pc + 1];
+                }
+                break;
+            }
+            case OP_CALL:
+            case OP_TAILCALL:
+            {
+                gc_safe_point();
+
+                U64 const argc = code[pc];
+                U64 const top = m_stack.size() - argc;
+                Expr const head = m_stack[top - 1];
+                if (is_builtin_function(head))
+                {
+                    Expr const ret = builtin_call(head, m_stack.data() + top, argc, env);
+                    truncate(top - 1);
+                    m_stack.push_back(ret);
+                    pc += 4;
+                    break;
+                }
+
+                Analysis * analysis = cached_analysis(head, code + pc);
+                if (analysis->dynamic)
+                {
+                    Expr const vals = pop_list(top);
+                    pop();
+                    m_stack.push_back(call_closure(head, vals));
+                    pc += 4;
+                    break;
+                }
+
+                U64 * callee = program(analysis);
+                Expr const frame = make_frame(analysis->names, analysis->size, closure_env(head));
+                frame_bind_values(frame, closure_args(head), m_stack.data() + top, argc);
+                truncate(top - 1);
+
+                if (code[pc - 1] == OP_TAILCALL)
+                {
+                    m_frames.back() = { head, callee, 0, frame };
+                    m_frames_floor = std::min(m_frames_floor, m_frames.size() - 1);
+                }
+                else
+                {
+                    if (m_frames.size() >= LISP_EVAL_DEPTH_LIMIT)
+                    {
+                        LISP_FAIL("call depth limit of %d exceeded\n", LISP_EVAL_DEPTH_LIMIT);
+                    }
+                    m_frames.back().pc = pc + 4;
+                    m_frames.push_back({ head, callee, 0, frame });
+                }
+                code = callee;
+                pc = 0;
+                env = frame;
+                break;
+            }
+            case OP_RETURN:
+                m_frames.pop_back();
+                m_frames_floor = std::min(m_frames_floor, m_frames.size());
+                if (m_frames.size() == base)
+                {
+                    Expr const ret = m_stack.back();
+                    pop();
+                    return ret;
+                }
+                code = m_frames.back().code;
+                pc = m_frames.back().pc;
+                env = m_frames.back().env;
+                break;
+            default:
+                LISP_FAIL("illegal instruction %" PRIu64 "\n", code[pc - 1]);
+                break;
+            }
+        }
+    }
+
+    /* the env of the running call is a root */
+    void set_env(Expr env)
+    {
+        m_frames.back().env = env;
+        m_frames_floor = std::min(m_frames_floor, m_frames.size() - 1);
+    }
+
+    void pop()
+    {
+        m_stack.pop_back();
+        m_stack_floor = std::min(m_stack_floor, m_stack.size());
+    }
+
+    void truncate(size_t size)
+    {
+        m_stack.resize(size);
+        m_stack_floor = std::min(m_stack_floor, size);
+    }
+
+    Expr outer_frame(Expr env, U64 depth)
+    {
+        for (; depth > 0; --depth)
+        {
+            env = frame_outer(env);
+        }
+        return env;
+    }
+
+    /* the cached analysis stays valid until a collection, which is the
+       only thing that drops analyses and reuses closures, or until it
+       goes stale */
+    Analysis * cached_analysis(Expr fun, U64 * cache)
+    {
+        if (cache[1] != fun || cache[3] != gc_epoch() || ((Analysis *) (uintptr_t) cache[2])->stale)
+        {
+            if (!is_function(fun))
+            {
+                LISP_FAIL("cannot apply %s\n", repr(fun));
+            }
+            cache[1] = fun;
+            cache[2] = (U64) (uintptr_t) closure_analysis(fun);
+            cache[3] = gc_epoch();
+        }
+        return (Analysis *) (uintptr_t) cache[2];
+    }
+
+    /* pops the values from top on as a list, no collection can happen
+       while it is made */
+    Expr pop_list(U64 top)
+    {
+        Expr ret = nil;
+        for (U64 i = m_stack.size(); i > top; --i)
+        {
+            ret = cons(m_stack[i - 1], ret);
+        }
+        truncate(top);
+        return ret;
+    }
+
+    U64 * program(Analysis * analysis)
+    {
+        if (analysis->program.empty())
+        {
+            compile(analysis->code, analysis->program);
+        }
+        return analysis->program.data();
+    }
+
+    void compile(Expr body, std::vector<U64> & out)
+    {
+        compile_body(body, out, true);
+        out.push_back(OP_RETURN);
+    }
+
+    void compile_body(Expr body, std::vector<U64> & out, bool tail)
+    {
+        if (!body)
+        {
+            out.push_back(OP_CONST);
+            out.push_back(nil);
+        }
+        for (Expr tmp = body; tmp; tmp = cdr(tmp))
+        {
+            compile_expr(car(tmp), out, tail && !cdr(tmp));
+            if (cdr(tmp))
+            {
+                out.push_back(OP_POP);
+            }
+        }
+    }
+
+    size_t compile_jump(U64 op, std::vector<U64> & out)
+    {
+        out.push_back(op);
+        out.push_back(0);
+        return out.size() - 1;
+    }
+
+    void compile_expr(Expr exp, std::vector<U64> & out, bool tail = false)
+    {
+        switch (expr_type(exp))
+        {
+        case TYPE_NIL:
+        case TYPE_CHAR:
+        case TYPE_FIXNUM:
+        case TYPE_FLOAT:
+        case TYPE_STRING:
+        case TYPE_KEYWORD:
+#if LISP_WANT_POINTER
+        case TYPE_POINTER:
+#endif
+            out.push_back(OP_CONST);
+            out.push_back(exp);
+            break;
+        case TYPE_SYMBOL:
+#if LISP_WANT_GENSYM
+        case TYPE_GENSYM:
+#endif
+            out.push_back(OP_VAR);
+            out.push_back(exp);
+            break;
+        case TYPE_LOCAL_REF:
+            out.push_back(OP_LOCAL);
+            out.push_back(exp);
+            break;
+        case TYPE_GLOBAL_REF:
+            out.push_back(OP_GLOBAL);
+            out.push_back(exp);
+            break;
+        case TYPE_CONS:
+            compile_call(exp, out, tail);
+            break;
+        default:
+            out.push_back(OP_EVAL);
+            out.push_back(exp);
+            break;
+        }
+    }
+
+    void compile_call(Expr exp, std::vector<U64> & out, bool tail)
+    {
+        Expr const head = car(exp);
+        Expr const args = cdr(exp);
+
+        if (is_builtin_special(head))
+        {
+            compile_special(head, args, out, tail);
+            return;
+        }
+
+        if (is_builtin(head) || is_function(head) || is_macro(head))
+        {
+            out.push_back(OP_CONST);
+            out.push_back(head);
+        }
+        else
+        {
+            compile_expr(head, out);
+        }
+
+        out.push_back(OP_CHECK);
+        out.push_back(exp);
+        size_t const check = out.size();
+        out.push_back(0);
+
+        U64 argc = 0;
+        for (Expr tmp = args; tmp; tmp = cdr(tmp), ++argc)
+        {
+            compile_expr(car(tmp), out);
+        }
+        out.push_back(tail ? OP_TAILCALL : OP_CALL);
+        out.push_back(argc);
+        out.push_back(nil);
+        out.push_back(0);
+        out.push_back(0);
+        out[check] = out.size();
+    }
+
+    /* follows the builtins of lang_init */
+    void compile_special(Expr special, Expr args, std::vector<U64> & out, bool tail)
+    {
+        U64 const kind = builtin_special_kind(special);
+        switch (kind)
+        {
+        case SPECIAL_QUOTE:
+            out.push_back(OP_CONST);
+            out.push_back(car(args));
+            break;
+        case SPECIAL_IF:
+        {
+            compile_expr(car(args), out);
+            out.push_back(OP_JUMPNIL);
+            size_t const jump_else = out.size();
+            out.push_back(0);
+            compile_expr(cadr(args), out, tail);
+            out.push_back(OP_JUMP);
+            size_t const jump_end = out.size();
+            out.push_back(0);
+            out[jump_else] = out.size();
+            if (cddr(args))
+            {
+                compile_expr(caddr(args), out, tail);
+            }
+            else
+            {
+                out.push_back(OP_CONST);
+                out.push_back(nil);
+            }
+            out[jump_end] = out.size();
+            break;
+        }
+        case SPECIAL_PROGN:
+            compile_body(args, out, tail);
+            break;
+        case SPECIAL_WHEN:
+        case SPECIAL_UNLESS:
+        {
+            compile_expr(car(args), out);
+            size_t const jump_else = compile_jump(OP_JUMPNIL, out);
+            if (kind == SPECIAL_WHEN)
+            {
+                compile_body(cdr(args), out, tail);
+            }
+            else
+            {
+                out.push_back(OP_CONST);
+                out.push_back(nil);
+            }
+            size_t const jump_end = compile_jump(OP_JUMP, out);
+            out[jump_else] = out.size();
+            if (kind == SPECIAL_WHEN)
+            {
+                out.push_back(OP_CONST);
+                out.push_back(nil);
+            }
+            else
+            {
+                compile_body(cdr(args), out, tail);
+            }
+            out[jump_end] = out.size();
+            break;
+        }
+        case SPECIAL_COND:
+        {
+            std::vector<size_t> jumps_end;
+            for (Expr clauses = args; clauses; clauses = cdr(clauses))
+            {
+                compile_expr(caar(clauses), out);
+                size_t const jump_next = compile_jump(OP_JUMPNIL, out);
+                compile_body(cdar(clauses), out, tail);
+                jumps_end.push_back(compile_jump(OP_JUMP, out));
+                out[jump_next] = out.size();
+            }
+            out.push_back(OP_CONST);
+            out.push_back(nil);
+            for (auto jump : jumps_end)
+            {
+                out[jump] = out.size();
+            }
+            break;
+        }
+        case SPECIAL_AND:
+        {
+            if (!args)
+            {
+                out.push_back(OP_CONST);
+                out.push_back(LISP_SYMBOL_T);
+                return;
+            }
+            std::vector<size_t> jumps_nil;
+            for (; cdr(args); args = cdr(args))
+            {
+                compile_expr(car(args), out);
+                jumps_nil.push_back(compile_jump(OP_JUMPNIL, out));
+            }
+            compile_expr(car(args), out, tail);
+            size_t const jump_end = compile_jump(OP_JUMP, out);
+            for (auto jump : jumps_nil)
+            {
+                out[jump] = out.size();
+            }
+            out.push_back(OP_CONST);
+            out.push_back(nil);
+            out[jump_end] = out.size();
+            break;
+        }
+        case SPECIAL_OR:
+        {
+            if (!args)
+            {
+                out.push_back(OP_CONST);
+                out.push_back(nil);
+                return;
+            }
+            std::vector<size_t> jumps_end;
+            for (; cdr(args); args = cdr(args))
+            {
+                compile_expr(car(args), out);
+                jumps_end.push_back(compile_jump(OP_JUMPTRUE, out));
+            }
+            compile_expr(car(args), out, tail);
+            for (auto jump : jumps_end)
+            {
+                out[jump] = out.size();
+            }
+            break;
+        }
+        case SPECIAL_FRAME_LET:
+        {
+            Expr const names = car(args);
+            U64 size = 0;
+            for (Expr inits = cadr(args); inits; inits = cdr(inits), ++size)
+            {
+                compile_expr(car(inits), out);
+            }
+            if (names)
+            {
+                out.push_back(OP_ENTER);
+                out.push_back(names);
+                out.push_back(size);
+            }
+            compile_body(cddr(args), out, tail);
+            if (names)
+            {
+                out.push_back(OP_LEAVE);
+            }
+            break;
+        }
+        case SPECIAL_WHILE:
+        {
+            size_t const loop = out.size();
+            compile_expr(car(args), out);
+            out.push_back(OP_JUMPNIL);
+            size_t const jump_end = out.size();
+            out.push_back(0);
+            for (Expr tmp = cdr(args); tmp; tmp = cdr(tmp))
+            {
+                compile_expr(car(tmp), out);
+                out.push_back(OP_POP);
+            }
+            out.push_back(OP_JUMP);
+            out.push_back(loop);
+            out[jump_end] = out.size();
+            out.push_back(OP_CONST);
+            out.push_back(nil);
+            break;
+        }
+        default:
+            out.push_back(OP_SPECIAL);
+            out.push_back(special);
+            out.push_back(args);
+            break;
+        }
+    }
+
+private:
+    std::vector<Expr> m_stack;
+    std::vector<VmFrame> m_frames;
+    size_t m_stack_floor = 0;
+    size_t m_frames_floor = 0;
+};
+
+#if LISP_WANT_GLOBAL_API
+
+VmImpl g_vm;
+
+Expr vm_call(Expr fun, Analysis * analysis, Expr vals)
+{
+    return g_vm.call(fun, analysis, vals);
+}
+
+#endif
+
+#ifdef LISP_NAMESPACE
+}
+#endif
+
+#line 2 "src/tree.impl"
+#ifdef LISP_NAMESPACE
+namespace LISP_NAMESPACE {
+#endif
+
+/* analyzed closure bodies are turned into a tree of nodes, one per form,
+   which run by calling each other, a lighter alternative to the vm that
+   still recurses in C++ for every call that is not a tail call
+
+   values that have to survive a collection, like args evaluated so far
+   and the function and frame of a running call, are kept on a stack of
+   its own that the collector scans
+
+   a call in tail position leaves the function and frame it set up on
+   that stack and returns to the body it is part of, which then runs the
+   callee in place of itself */
+
+class TreeImpl;
+
+class TreeNode
+{
+public:
+    virtual ~TreeNode()
+    {
+    }
+
+    virtual Expr run(TreeImpl & tree, Expr env) = 0;
+};
+
+typedef std::unique_ptr<TreeNode> TreeNodePtr;
+
+struct TreeBody
+{
+    std::vector<TreeNodePtr> nodes;
+};
+
+struct TreeCallCache
+{
+    Expr fun;
+    Analysis * analysis;
+    U64 epoch;
+};
+
+class TreeImpl
+{
+public:
+    Expr call(Expr fun, Analysis * analysis, Expr vals)
+    {
+        LISP_ASSERT(!analysis->dynamic);
+        Unwind const unwind(*this);
+
+        GcRoot const vals_root(vals);
+        TreeBody const * body = compiled(analysis);
+        U64 const top = push(fun);
+        Expr const frame = make_frame(analysis->names, analysis->size, closure_env(fun));
+        push(frame);
+        frame_bind(frame, closure_args(fun), vals);
+        return run(top, body, frame);
+    }
+
+    /* calls the function at top with the values above it */
+    Expr call(U64 top, Expr env, TreeCallCache & cache, bool tail)
+    {
+        gc_safe_point();
+
+        Expr const fun = m_stack[top];
+        U64 const argc = m_stack.size() - top - 1;
+        if (is_builtin_function(fun))
+        {
+            Expr const ret = builtin_call(fun, m_stack.data() + top + 1, argc, env);
+            m_stack.resize(top);
+            return ret;
+        }
+
+        Analysis * analysis = cached_analysis(fun, cache);
+        if (analysis->dynamic)
+        {
+            Expr const vals = pop_list(top + 1);
+            m_stack.back() = vals;
+            Expr const ret = call_closure(fun, vals);
+            m_stack.resize(top);
+            return ret;
+        }
+
+        TreeBody const * body = compiled(analysis);
+        Expr const frame = make_frame(analysis->names, analysis->size, closure_env(fun));
+        frame_bind_values(frame, closure_args(fun), m_stack.data() + top + 1, argc);
+        m_stack.resize(top + 1);
+        push(frame);
+        if (tail)
+        {
+            m_tail = body;
+            return nil;
+        }
+        return run(top, body, frame);
+    }
+
+    U64 push(Expr exp)
+    {
+        m_stack.push_back(exp);
+        return m_stack.size() - 1;
+    }
+
+    U64 top() const
+    {
+        return m_stack.size();
+    }
+
+    /* binds the values from top on in a frame of a let, which takes
+       their place on the stack */
+    Expr enter(U64 top, Expr names, Expr env)
+    {
+        U64 const size = m_stack.size() - top;
+        Expr const frame = make_frame(names, size, env);
+        for (U64 slot = 0; slot < size; ++slot)
+        {
+            frame_set(frame, slot, m_stack[top + slot]);
+        }
+        m_stack.resize(top);
+        push(frame);
+        return frame;
+    }
+
+    /* a call in tail position left its own function and frame above the
+       frame of the let, run() drops them all then */
+    void leave(U64 top)
+    {
+        if (!m_tail)
+        {
+            m_stack.resize(top);
+        }
+    }
+
+    template <typename Func>
+    void each_root(Func func)
+    {
+        for (auto exp : m_stack)
+        {
+            func(exp);
+        }
+    }
+
+protected:
+    /* drops whatever a failed call left on the stack */
+    class Unwind
+    {
+    public:
+        Unwind(TreeImpl & tree) : m_tree(tree), m_size(tree.m_stack.size())
+        {
+        }
+
+        ~Unwind()
+        {
+            m_tree.m_stack.resize(m_size);
+            m_tree.m_tail = nullptr;
+        }
+
+    private:
+        TreeImpl & m_tree;
+        size_t m_size;
+    };
+
+    /* runs body with the function and frame of the call at top */
+    Expr run(U64 top, TreeBody const * body, Expr env)
+    {
+        if (eval_stack_low())
+        {
+            return eval_on_new_stack([&]() { return run(top, body, env); });
+        }
+        EvalGuard const guard;
+        for (;;)
+        {
+            Expr ret = nil;
+            for (auto const & node : body->nodes)
+            {
+                ret = node->run(*this, env);
+            }
+            if (!m_tail)
+            {
+                m_stack.resize(top);
+                return ret;
+            }
+
+            body = m_tail;
+            m_tail = nullptr;
+            env = m_stack.back();
+            m_stack[top] = m_stack[m_stack.size() - 2];
+            m_stack[top + 1] = env;
+            m_stack.resize(top + 2);
+        }
+    }
+
+    /* the cached analysis stays valid until a collection, which is the
+       only thing that drops analyses and reuses closures, or until it
+       goes stale */
+    Analysis * cached_analysis(Expr fun, TreeCallCache & cache)
+    {
+        if (cache.fun != fun || cache.epoch != gc_epoch() || cache.analysis->stale)
+        {
+            if (!is_function(fun))
+            {
+                LISP_FAIL("cannot apply %s\n", repr(fun));
+            }
+            cache.fun = fun;
+            cache.analysis = closure_analysis(fun);
+            cache.epoch = gc_epoch();
+        }
+        return cache.analysis;
+    }
+
+    /* pops the values from top on as a list, no collection can happen
+       while it is made */
+    Expr pop_list(U64 top)
+    {
+        Expr ret = nil;
+        for (U64 i = m_stack.size(); i > top; --i)
+        {
+            ret = cons(m_stack[i - 1], ret);
+        }
+        m_stack.resize(top);
+        return ret;
+    }
+
+    TreeBody const * compiled(Analysis * analysis);
+
+private:
+    std::vector<Expr> m_stack;
+    TreeBody const * m_tail = nullptr;
+};
+
+class TreeConstNode : public TreeNode
+{
+public:
+    TreeConstNode(Expr exp) : m_exp(exp)
+    {
+    }
+
+    Expr run(TreeImpl &, Expr)
+    {
+        return m_exp;
+    }
+
+private:
+    Expr m_exp;
+};
+
+class TreeEvalNode : public TreeNode
+{
+public:
+    TreeEvalNode(Expr exp) : m_exp(exp)
+    {
+    }
+
+    Expr run(TreeImpl &, Expr env)
+    {
+        return eval(m_exp, env);
+    }
+
+private:
+    Expr m_exp;
+};
+
+class TreeLocalNode : public TreeNode
+{
+public:
+    TreeLocalNode(U64 depth, U64 slot) : m_depth(depth), m_slot(slot)
+    {
+    }
+
+    Expr run(TreeImpl &, Expr env)
+    {
+        for (U64 depth = m_depth; depth > 0; --depth)
+        {
+            env = frame_outer(env);
+        }
+        return frame_get(env, m_slot);
+    }
+
+private:
+    U64 m_depth;
+    U64 m_slot;
+};
+
+/* root env cells live in vectors that grow, so the node keeps the var
+   and the lookup goes through env_get */
+class TreeGlobalNode : public TreeNode
+{
+public:
+    TreeGlobalNode(U64 depth, Expr var) : m_depth(depth), m_var(var)
+    {
+    }
+
+    Expr run(TreeImpl &, Expr env)
+    {
+        for (U64 depth = m_depth; depth > 0; --depth)
+        {
+            env = frame_outer(env);
+        }
+        return env_get(env, m_var);
+    }
+
+private:
+    U64 m_depth;
+    Expr m_var;
+};
+
+class TreeVarNode : public TreeNode
+{
+public:
+    TreeVarNode(Expr var) : m_var(var)
+    {
+    }
+
+    Expr run(TreeImpl &, Expr env)
+    {
+        return env_get(env, m_var);
+    }
+
+private:
+    Expr m_var;
+};
+
+class TreeSpecialNode : public TreeNode
+{
+public:
+    TreeSpecialNode(Expr special, Expr args) : m_special(special), m_args(args)
+    {
+    }
+
+    Expr run(TreeImpl &, Expr env)
+    {
+        return builtin_func(m_special)(m_args, env);
+    }
+
+private:
+    Expr m_special;
+    Expr m_args;
+};
+
+class TreeIfNode : public TreeNode
+{
+public:
+    TreeIfNode(TreeNode * test, TreeNode * then, TreeNode * otherwise) :
+        m_test(test), m_then(then), m_else(otherwise)
+    {
+    }
+
+    Expr run(TreeImpl & tree, Expr env)
+    {
+        return m_test->run(tree, env) ? m_then->run(tree, env) : m_else->run(tree, env);
+    }
+
+private:
+    TreeNodePtr m_test;
+    TreeNodePtr m_then;
+    TreeNodePtr m_else;
+};
+
+class TreeWhileNode : public TreeNode
+{
+public:
+    TreeWhileNode(TreeNode * test, TreeBody * body) : m_test(test), m_body(body)
+    {
+    }
+
+    Expr run(TreeImpl & tree, Expr env)
+    {
+        while (m_test->run(tree, env))
+        {
+            for (auto const & node : m_body->nodes)
+            {
+                node->run(tree, env);
+            }
+        }
+        return nil;
+    }
+
+private:
+    TreeNodePtr m_test;
+    std::unique_ptr<TreeBody> m_body;
+};
+
+class TreePrognNode : public TreeNode
+{
+public:
+    TreePrognNode(TreeBody * body) : m_body(body)
+    {
+    }
+
+    Expr run(TreeImpl & tree, Expr env)
+    {
+        Expr ret = nil;
+        for (auto const & node : m_body->nodes)
+        {
+            ret = node->run(tree, env);
+        }
+        return ret;
+    }
+
+private:
+    std::unique_ptr<TreeBody> m_body;
+};
+
+class TreeOrNode : public TreeNode
+{
+public:
+    TreeOrNode(TreeBody * body) : m_body(body)
+    {
+    }
+
+    Expr run(TreeImpl & tree, Expr env)
+    {
+        Expr ret = nil;
+        for (auto const & node : m_body->nodes)
+        {
+            ret = node->run(tree, env);
+            if (ret)
+            {
+                break;
+            }
+        }
+        return ret;
+    }
+
+private:
+    std::unique_ptr<TreeBody> m_body;
+};
+
+class TreeLetNode : public TreeNode
+{
+public:
+    TreeLetNode(Expr names, TreeBody * inits, TreeBody * body) : m_names(names), m_inits(inits), m_body(body)
+    {
+    }
+
+    Expr run(TreeImpl & tree, Expr env)
+    {
+        U64 const top = tree.top();
+        for (auto const & node : m_inits->nodes)
+        {
+            tree.push(node->run(tree, env));
+        }
+        env = tree.enter(top, m_names, env);
+
+        Expr ret = nil;
+        for (auto const & node : m_body->nodes)
+        {
+            ret = node->run(tree, env);
+        }
+        tree.leave(top);
+        return ret;
+    }
+
+private:
+    Expr m_names;
+    std::unique_ptr<TreeBody> m_inits;
+    std::unique_ptr<TreeBody> m_body;
+};
+
+/* a head that turns out to be a special, a macro or anything else odd
+   at run time goes to apply() with the call as it is, like the tree
+   walker would */
+
+class TreeCallSite
+{
+public:
+    TreeCallSite(TreeNode * head, Expr call, bool tail) : m_head(head), m_call(call), m_tail(tail)
+    {
+        m_cache.fun = nil;
+        m_cache.analysis = nullptr;
+        m_cache.epoch = 0;
+    }
+
+protected:
+    bool head(TreeImpl & tree, Expr env, Expr & ret, U64 & top)
+    {
+        Expr const fun = m_head->run(tree, env);
+        if (!is_builtin_function(fun) && !is_function(fun))
+        {
+            ret = apply(fun, m_call, env);
+            return false;
+        }
+        top = tree.push(fun);
+        return true;
+    }
+
+    TreeNodePtr m_head;
+    Expr m_call;
+    bool m_tail;
+    TreeCallCache m_cache;
+};
+
+template <U64 N>
+class TreeCallNode : public TreeNode, protected TreeCallSite
+{
+public:
+    TreeCallNode(TreeNode * head, Expr call, bool tail, std::vector<TreeNode *> const & nodes) :
+        TreeCallSite(head, call, tail)
+    {
+        LISP_ASSERT(nodes.size() == N);
+        for (U64 i = 0; i < N; ++i)
+        {
+            m_nodes[i].reset(nodes[i]);
+        }
+    }
+
+    Expr run(TreeImpl & tree, Expr env)
+    {
+        Expr ret;
+        U64 top;
+        if (!head(tree, env, ret, top))
+        {
+            return ret;
+        }
+        for (U64 i = 0; i < N; ++i)
+        {
+            tree.push(m_nodes[i]->run(tree, env));
+        }
+        return tree.call(top, env, m_cache, m_tail);
+    }
+
+private:
+    TreeNodePtr m_nodes[N ? N : 1];
+};
+
+class TreeCallNodeN : public TreeNode, protected TreeCallSite
+{
+public:
+    TreeCallNodeN(TreeNode * head, Expr call, bool tail, std::vector<TreeNode *> const & nodes) :
+        TreeCallSite(head, call, tail)
+    {
+        for (auto node : nodes)
+        {
+            m_nodes.emplace_back(node);
+        }
+    }
+
+    Expr run(TreeImpl & tree, Expr env)
+    {
+        Expr ret;
+        U64 top;
+        if (!head(tree, env, ret, top))
+        {
+            return ret;
+        }
+        for (auto const & node : m_nodes)
+        {
+            tree.push(node->run(tree, env));
+        }
+        return tree.call(top, env, m_cache, m_tail);
+    }
+
+private:
+    std::vector<TreeNodePtr> m_nodes;
+};
+
+class TreeCompiler
+{
+public:
+    TreeBody * compile_body(Expr exps, bool tail)
+    {
+        TreeBody * body = new TreeBody();
+        for (; exps; exps = cdr(exps))
+        {
+            body->nodes.emplace_back(compile(car(exps), tail && !cdr(exps)));
+        }
+        return body;
+    }
+
+    TreeNode * compile(Expr exp, bool tail = false)
+    {
+        switch (expr_type(exp))
+        {
+        case TYPE_NIL:
+        case TYPE_CHAR:
+        case TYPE_FIXNUM:
+        case TYPE_FLOAT:
+        case TYPE_STRING:
+        case TYPE_KEYWORD:
+#if LISP_WANT_POINTER
+        case TYPE_POINTER:
+#endif
+            return new TreeConstNode(exp);
+        case TYPE_SYMBOL:
+#if LISP_WANT_GENSYM
+        case TYPE_GENSYM:
+#endif
+            return new TreeVarNode(exp);
+        case TYPE_LOCAL_REF:
+            return new TreeLocalNode(local_ref_depth(exp), local_ref_slot(exp));
+        case TYPE_GLOBAL_REF:
+            return new TreeGlobalNode(global_ref_depth(exp), global_ref_var(exp));
+        case TYPE_CONS:
+            return compile_call(exp, tail);
+        default:
+            return new TreeEvalNode(exp);
+        }
+    }
+
+protected:
+    TreeNode * compile_call(Expr exp, bool tail)
+    {
+        Expr const head = car(exp);
+        Expr const args = cdr(exp);
+
+        if (is_builtin_special(head))
+        {
+            return compile_special(head, args, tail);
+        }
+
+        TreeNode * op = nullptr;
+        if (is_builtin(head) || is_function(head) || is_macro(head))
+        {
+            op = new TreeConstNode(head);
+        }
+        else
+        {
+            op = compile(head);
+        }
+
+        std::vector<TreeNode *> nodes;
+        for (Expr tmp = args; tmp; tmp = cdr(tmp))
+        {
+            nodes.push_back(compile(car(tmp)));
+        }
+
+        switch (nodes.size())
+        {
+        case 0: return new TreeCallNode<0>(op, exp, tail, nodes);
+        case 1: return new TreeCallNode<1>(op, exp, tail, nodes);
+        case 2: return new TreeCallNode<2>(op, exp, tail, nodes);
+        case 3: return new TreeCallNode<3>(op, exp, tail, nodes);
+        case 4: return new TreeCallNode<4>(op, exp, tail, nodes);
+        default: return new TreeCallNodeN(op, exp, tail, nodes);
+        }
+    }
+
+    /* follows the builtins of lang_init */
+    TreeNode * compile_special(Expr special, Expr args, bool tail)
+    {
+        U64 const kind = builtin_special_kind(special);
+        switch (kind)
+        {
+        case SPECIAL_QUOTE:
+            return new TreeConstNode(car(args));
+        case SPECIAL_IF:
+        {
+            TreeNode * test = compile(car(args));
+            TreeNode * then = compile(cadr(args), tail);
+            TreeNode * otherwise = cddr(args) ? compile(caddr(args), tail) : new TreeConstNode(nil);
+            return new TreeIfNode(test, then, otherwise);
+        }
+        case SPECIAL_WHILE:
+        {
+            TreeNode * test = compile(car(args));
+            return new TreeWhileNode(test, compile_body(cdr(args), false));
+        }
+        case SPECIAL_PROGN:
+            return compile_progn(args, tail);
+        case SPECIAL_WHEN:
+        case SPECIAL_UNLESS:
+        {
+            TreeNode * test = compile(car(args));
+            TreeNode * body = compile_progn(cdr(args), tail);
+            return kind == SPECIAL_WHEN ?
+                new TreeIfNode(test, body, new TreeConstNode(nil)) :
+                new TreeIfNode(test, new TreeConstNode(nil), body);
+        }
+        case SPECIAL_COND:
+            return compile_cond(args, tail);
+        case SPECIAL_AND:
+            return compile_and(args, tail);
+        case SPECIAL_OR:
+            if (!args)
+            {
+                return new TreeConstNode(nil);
+            }
+            return new TreeOrNode(compile_body(args, tail));
+        case SPECIAL_FRAME_LET:
+            if (!car(args))
+            {
+                return compile_progn(cddr(args), tail);
+            }
+            return new TreeLetNode(car(args), compile_body(cadr(args), false), compile_body(cddr(args), tail));
+        default:
+            return new TreeSpecialNode(special, args);
+        }
+    }
+
+    TreeNode * compile_progn(Expr exps, bool tail)
+    {
+        if (!exps)
+        {
+            return new TreeConstNode(nil);
+        }
+        else if (!cdr(exps))
+        {
+            return compile(car(exps), tail);
+        }
+        return new TreePrognNode(compile_body(exps, tail));
+    }
+
+    TreeNode * compile_cond(Expr clauses, bool tail)
+    {
+        if (!clauses)
+        {
+            return new TreeConstNode(nil);
+        }
+        TreeNode * test = compile(caar(clauses));
+        TreeNode * then = compile_progn(cdar(clauses), tail);
+        return new TreeIfNode(test, then, compile_cond(cdr(clauses), tail));
+    }
+
+    TreeNode * compile_and(Expr exps, bool tail)
+    {
+        if (!exps)
+        {
+            return new TreeConstNode(LISP_SYMBOL_T);
+        }
+        else if (!cdr(exps))
+        {
+            return compile(car(exps), tail);
+        }
+        TreeNode * test = compile(car(exps));
+        return new TreeIfNode(test, compile_and(cdr(exps), tail), new TreeConstNode(nil));
+    }
+};
+
+TreeBody const * TreeImpl::compiled(Analysis * analysis)
+{
+    if (!analysis->tree)
+    {
+        analysis->tree.reset(TreeCompiler().compile_body(analysis->code, true));
+    }
+    return analysis->tree.get();
+}
+
+#if LISP_WANT_GLOBAL_API
+
+TreeImpl g_tree;
+
+Expr tree_call(Expr fun, Analysis * analysis, Expr vals)
+{
+    return g_tree.call(fun, analysis, vals);
+}
+
+#endif
+
+#ifdef LISP_NAMESPACE
+}
+#endif
+
+#line 2 "src/gc.impl"
+#ifdef LISP_NAMESPACE
+namespace LISP_NAMESPACE {
+#endif
+
+#if LISP_WANT_GLOBAL_API
+
+#define LISP_GC_HISTOGRAM_SIZE 24
+
+struct GcPauses
+{
+    U64 count;
+    U64 total_us;
+    U64 buckets[LISP_GC_HISTOGRAM_SIZE];
+};
+
+class GcImpl
+{
+public:
+    GcImpl() : m_made(0), m_epoch(0), m_threshold(LISP_GC_THRESHOLD), m_start(std::chrono::steady_clock::now())
+    {
+        memset(&m_minor, 0, sizeof(GcPauses));
+        memset(&m_major, 0, sizeof(GcPauses));
+    }
+
+    void push_root(Expr const * root)
+    {
+        m_roots.push_back(root);
+    }
+
+    void pop_root()
+    {
+        LISP_ASSERT(!m_roots.empty());
+        m_roots.pop_back();
+    }
+
+    void protect(Expr exp)
+    {
+        m_protected.push_back(exp);
+    }
+
+    void unprotect(Expr exp)
+    {
+        for (size_t i = m_protected.size(); i > 0; --i)
+        {
+            if (m_protected[i - 1] == exp)
+            {
+                m_protected[i - 1] = m_protected.back();
+                m_protected.pop_back();
+                return;
+            }
+        }
+        LISP_FAIL("cannot unprotect %s, it is not protected\n", repr(exp));
+    }
+
+    void safe_point()
+    {
+        if (!m_threshold)
+        {
+            return;
+        }
+#if LISP_GC_GENERATIONAL
+        if (made() - m_made >= LISP_GC_NURSERY_SIZE)
+        {
+            collect_young();
+            if (live() >= m_threshold)
+            {
+                collect();
+            }
+        }
+#else
+        if (made() - m_made >= m_threshold)
+        {
+            collect();
+        }
+#endif
+    }
+
+    U64 collect()
+    {
+        auto const start = std::chrono::steady_clock::now();
+
+        ++m_epoch;
+        mark_roots(false);
+        trace_weak();
+
+        U64 freed = 0;
+        freed += g_cons.sweep();
+        freed += g_string.sweep();
+        freed += g_frame.sweep();
+        freed += g_closure.sweep();
+#if LISP_WANT_POINTER
+        freed += g_pointer.sweep();
+#endif
+
+        m_made = made();
+        if (m_threshold)
+        {
+            // let the heap grow in proportion to what survived
+            U64 const survivors = LISP_GC_GENERATIONAL ? 2 * live() : live();
+            m_threshold = survivors > LISP_GC_THRESHOLD ? survivors : LISP_GC_THRESHOLD;
+        }
+
+        record(m_major, start);
+        return freed;
+    }
+
+    U64 collect_young()
+    {
+        auto const start = std::chrono::steady_clock::now();
+
+        ++m_epoch;
+        mark_roots(true);
+        auto const push = [this](Expr exp)
+        {
+            m_stack.push_back(exp);
+        };
+        g_env.each_value(push);
+        g_analyze.each_value(push);
+        g_macro.each_value(push);
+        g_closure.each_value(push);
+        g_frame.each_remembered([this, push](Expr exp)
+        {
+            g_frame.each_child(exp, push);
+        });
+        g_cons.each_remembered([this](Expr exp)
+        {
+            m_stack.push_back(g_cons.car(exp));
+            m_stack.push_back(g_cons.cdr(exp));
+        });
+        drain(true);
+
+        U64 freed = 0;
+        freed += g_cons.sweep_young();
+        freed += g_string.sweep_young();
+        freed += g_frame.sweep_young();
+        freed += g_closure.sweep_young();
+#if LISP_WANT_POINTER
+        freed += g_pointer.sweep_young();
+#endif
+
+        m_made = made();
+        record(m_minor, start);
+        return freed;
+    }
+
+    /* changes with every collection, which is when exprs can be reused,
+       and whenever analyses are dropped */
+    U64 epoch() const
+    {
+        return m_epoch;
+    }
+
+    void next_epoch()
+    {
+        ++m_epoch;
+    }
+
+    void print_stats(FILE * file)
+    {
+        U64 const us = elapsed_us(m_start);
+        U64 const allocs = made();
+        fprintf(file, "gc: %" PRIu64 " allocation(s) in %.3f s (%.0f allocation(s)/s), %" PRIu64 " live\n",
+                allocs, us / 1e6, us ? allocs / (us / 1e6) : 0.0, live());
+        print_pauses(file, "minor", m_minor);
+        print_pauses(file, "major", m_major);
+    }
+
+    /* allocations since the start */
+    U64 made() const
+    {
+        U64 ret = g_cons.made() + g_string.made() + g_frame.made();
+        ret += g_closure.made();
+#if LISP_WANT_POINTER
+        ret += g_pointer.made();
+#endif
+        return ret;
+    }
+
+protected:
+    U64 live() const
+    {
+        U64 ret = g_cons.live() + g_string.live() + g_frame.live();
+        ret += g_closure.live();
+#if LISP_WANT_POINTER
+        ret += g_pointer.live();
+#endif
+        return ret;
+    }
+
+    void mark_roots(bool young_only)
+    {
+        for (auto root : m_roots)
+        {
+            m_stack.push_back(*root);
+        }
+        for (auto exp : m_protected)
+        {
+            m_stack.push_back(exp);
+        }
+        auto const push = [this](Expr exp)
+        {
+            m_stack.push_back(exp);
+        };
+        g_vm.each_root(push, young_only);
+        g_tree.each_root(push);
+        drain(young_only);
+    }
+
+    /* root env value cells, analyzed code, macro expansions and decoded
+       closure lists are only reachable while their root env, closure
+       body, call site and macro or list are, which is only known once
+       those have been marked */
+    void trace_weak()
+    {
+        auto const is_marked = [](Expr exp)
+        {
+            U64 const type = expr_type(exp);
+            if (type == TYPE_CLOSURE_FUN || type == TYPE_CLOSURE_MAC)
+            {
+                return g_closure.is_marked(exp);
+            }
+            return !is_cons(exp) || g_cons.is_marked(exp);
+        };
+        auto const push = [this](Expr exp)
+        {
+            m_stack.push_back(exp);
+        };
+        for (;;)
+        {
+            bool const envs = g_env.each_reachable_value(is_marked, push);
+            bool const bodies = g_analyze.each_reachable_value(is_marked, push);
+            bool const expansions = g_macro.each_reachable_value(is_marked, push);
+            bool const closures = g_closure.each_reachable_value(is_marked, push);
+            if (!envs && !bodies && !expansions && !closures)
+            {
+                break;
+            }
+            drain(false);
+        }
+        g_env.sweep(is_marked);
+        g_analyze.sweep(is_marked);
+        g_macro.sweep(is_marked);
+        g_closure.sweep(is_marked);
+    }
+
+    /* old objects only point at old objects unless they are in the
+       remembered set, so a minor collection stops tracing at them */
+    void drain(bool young_only)
+    {
+        while (!m_stack.empty())
+        {
+            Expr const exp = m_stack.back();
+            m_stack.pop_back();
+
+            switch (expr_type(exp))
+            {
+            case TYPE_CONS:
+                if (g_cons.mark(exp, young_only))
+                {
+                    m_stack.push_back(g_cons.cdr(exp));
+                    m_stack.push_back(g_cons.car(exp));
+                }
+                break;
+            case TYPE_STRING:
+                g_string.mark(exp, young_only);
+                break;
+            case TYPE_FRAME:
+                if (g_frame.mark(exp, young_only))
+                {
+                    g_frame.each_child(exp, [this](Expr child)
+                    {
+                        m_stack.push_back(child);
+                    });
+                }
+                break;
+#if LISP_WANT_POINTER
+            case TYPE_POINTER:
+                g_pointer.mark(exp, young_only);
+                break;
+#endif
+            case TYPE_CLOSURE_FUN:
+            case TYPE_CLOSURE_MAC:
+                if (g_closure.mark(exp, young_only))
+                {
+                    m_stack.push_back(g_closure.env(exp));
+                    m_stack.push_back(g_closure.name(exp));
+                    m_stack.push_back(g_closure.args(exp));
+                    m_stack.push_back(g_closure.body(exp));
+                }
+                break;
+            default:
+                /* immediate, interned, or owned by the host (streams, builtins) */
+                break;
+            }
+        }
+    }
+
+    U64 elapsed_us(std::chrono::steady_clock::time_point start) const
+    {
+        auto const delta = std::chrono::steady_clock::now() - start;
+        return (U64) std::chrono::duration_cast<std::chrono::microseconds>(delta).count();
+    }
+
+    void record(GcPauses & pauses, std::chrono::steady_clock::time_point start)
+    {
+        U64 const us = elapsed_us(start);
+        U64 bucket = 0;
+        while (bucket + 1 < LISP_GC_HISTOGRAM_SIZE && (UINT64_C(1) << bucket) <= us)
+        {
+            ++bucket;
+        }
+        ++pauses.count;
+        ++pauses.buckets[bucket];
+        pauses.total_us += us;
+    }
+
+    void print_pauses(FILE * file, char const * kind, GcPauses const & pauses)
+    {
+        fprintf(file, "gc: %" PRIu64 " %s collection(s), %.3f ms total pause\n",
+                pauses.count, kind, pauses.total_us / 1e3);
+        for (U64 bucket = 0; bucket < LISP_GC_HISTOGRAM_SIZE; ++bucket)
+        {
+            if (pauses.buckets[bucket])
+            {
+                U64 const lo = bucket ? UINT64_C(1) << (bucket - 1) : 0;
+                U64 const hi = UINT64_C(1) << bucket;
+                fprintf(file, "  %8" PRIu64 " .. %8" PRIu64 " us: %" PRIu64 "\n", lo, hi, pauses.buckets[bucket]);
+            }
+        }
+    }
+
+private:
+    std::vector<Expr const *> m_roots;
+    std::vector<Expr> m_protected;
+    std::vector<Expr> m_stack;
+    U64 m_made;
+    U64 m_epoch;
+    U64 m_threshold;
+    std::chrono::steady_clock::time_point m_start;
+    GcPauses m_minor;
+    GcPauses m_major;
+};
+
+GcImpl g_gc;
+
+void gc_push_root(Expr const * root)
+{
+    g_gc.push_root(root);
+}
+
+void gc_pop_root()
+{
+    g_gc.pop_root();
+}
+
+void gc_protect(Expr exp)
+{
+    g_gc.protect(exp);
+}
+
+void gc_unprotect(Expr exp)
+{
+    g_gc.unprotect(exp);
+}
+
+void gc_safe_point()
+{
+    g_gc.safe_point();
+}
+
+U64 gc_collect()
+{
+    return g_gc.collect();
+}
+
+U64 gc_collect_young()
+{
+    return g_gc.collect_young();
+}
+
+U64 gc_epoch()
+{
+    return g_gc.epoch();
+}
+
+void gc_next_epoch()
+{
+    g_gc.next_epoch();
+}
+
+U64 gc_made()
+{
+    return g_gc.made();
+}
+
+void gc_print_stats(FILE * file)
+{
+    g_gc.print_stats(file);
+}
+
+#endif
+
+#ifdef LISP_NAMESPACE
+}
+#endif
+
+#line 2 "src/eval.impl"
+#ifdef LISP_NAMESPACE
+namespace LISP_NAMESPACE {
+#endif
+
+/* a segment of stack the evaluators go on on, with what to run on it
+   and what came of that */
+struct EvalSegment
+{
+#if LISP_EVAL_STACK_SEGMENTS
+    ucontext_t context;
+    ucontext_t caller;
+#endif
+    std::function<Expr()> const * func;
+    Expr ret;
+    std::exception_ptr error;
+};
+
+/* the evaluators recurse on the stack of the thread until it runs low,
+   then on segments of LISP_EVAL_SEGMENT_SIZE bytes allocated one after
+   the other as they go deeper and freed as they come back, so that deep
+   recursion in any of them, in closures without an analysis or through
+   builtins that call closures costs memory rather than the stack of the
+   thread, one segment is kept for the next time */
+
+class EvalImpl
+{
+public:
+    EvalImpl() : m_depth(0), m_low(0), m_grown(0), m_spare(nullptr), m_stack_low(0)
+    {
+    }
+
+    ~EvalImpl()
+    {
+        LISP_FREE(m_spare);
+    }
+
+    Expr eval(Expr exp, Expr env)
+    {
+        switch (expr_type(exp))
+        {
+        case TYPE_NIL:
+        case TYPE_CHAR:
+        case TYPE_FIXNUM:
+        case TYPE_FLOAT:
+        case TYPE_STRING:
+        case TYPE_KEYWORD:
+#if LISP_WANT_POINTER
+        case TYPE_POINTER:
+#endif
+            return exp;
+        case TYPE_SYMBOL:
+#if LISP_WANT_GENSYM
+        case TYPE_GENSYM:
+#endif
+            return env_get(env, exp);
+        case TYPE_LOCAL_REF:
+            return frame_get(outer_frame(env, local_ref_depth(exp)), local_ref_slot(exp));
+        case TYPE_GLOBAL_REF:
+            return env_get(outer_frame(env, global_ref_depth(exp)), global_ref_var(exp));
+        case TYPE_CONS:
+            return apply(car(exp), exp, env);
+        case TYPE_BUILTIN_SYMBOL:
+            return builtin_func(exp)(nil, env);
+        default:
+            LISP_FAIL("cannot evaluate %s\n", repr(exp));
+            return nil;
+        }
+    }
+
+    Expr eval_body(Expr exps, Expr env)
+    {
+        Expr ret = nil;
+        for (Expr tmp = exps; tmp; tmp = cdr(tmp))
+        {
+            Expr const exp = car(tmp);
+            ret = eval(exp, env);
+        }
+        return ret;
+    }
+
+    Expr eval_list(Expr exps, Expr env)
+    {
+        Expr ret = nil;
+        GcRoot const ret_root(ret);
+        for (Expr tmp = exps; tmp; tmp = cdr(tmp))
+        {
+            Expr const exp = car(tmp);
+            ret = cons(eval(exp, env), ret);
+        }
+        return nreverse(ret);
+    }
+
+    /* the last form of a closure body, the forms that specials like if
+       and let end in and whatever a macro expands to are evaluated in
+       the same loop, so calls in tail position do not grow the C++ stack
+
+       form is the call being applied and name what its head is taken to
+       be, the form is the call site its macro expansion is memoized by */
+    Expr apply(Expr name, Expr form, Expr env)
+    {
+        if (stack_low())
+        {
+            return on_new_stack([&]() { return apply(name, form, env); });
+        }
+        EvalGuard const guard;
+        Expr args = cdr(form);
+        Expr body = nil;
+        GcRoot const name_root(name);
+        GcRoot const form_root(form);
+        GcRoot const args_root(args);
+        GcRoot const env_root(env);
+        GcRoot const body_root(body);
+
+        for (;;)
+        {
+            gc_safe_point();
+
+            Expr exp = nil;
+            if (is_builtin_function(name))
+            {
+                return call_builtin(name, args, env);
+            }
+            else if (is_builtin_special(name))
+            {
+                if (!run_special(name, args, env, exp))
+                {
+                    return exp;
+                }
+            }
+            else if (is_function(name))
+            {
+                Expr const vals = eval_list(args, env);
+                GcRoot const vals_root(vals);
+                if (!enter(name, vals, body, env))
+                {
+                    return call(name, vals);
+                }
+                if (!body)
+                {
+                    return nil;
+                }
+                for (; cdr(body); body = cdr(body))
+                {
+                    eval(car(body), env);
+                }
+                exp = car(body);
+            }
+            else if (is_macro(name))
+            {
+                body = expand_macro(name, form);
+                exp = body;
+            }
+            else
+            {
+                // TODO check for unlimited recursion
+                name = eval(name, env);
+                continue;
+            }
+
+            if (!is_cons(exp))
+            {
+                return eval(exp, env);
+            }
+            form = exp;
+            name = car(form);
+            args = cdr(form);
+        }
+    }
+
+    Expr call(Expr fun, Expr vals)
+    {
+        if (stack_low())
+        {
+            return on_new_stack([&]() { return call(fun, vals); });
+        }
+        EvalGuard const guard;
+        GcRoot const fun_root(fun);
+        GcRoot const vals_root(vals);
+
+        Analysis * analysis = closure_analysis(fun);
+        if (analysis->dynamic)
+        {
+            return eval_body(closure_body(fun),
+                             make_call_env_from(closure_env(fun),
+                                                closure_args(fun),
+                                                vals));
+        }
+#if LISP_EVAL_ENGINE == LISP_EVAL_ENGINE_VM
+        return vm_call(fun, analysis, vals);
+#elif LISP_EVAL_ENGINE == LISP_EVAL_ENGINE_TREE
+        return tree_call(fun, analysis, vals);
+#else
+        Expr const frame = make_frame(analysis->names, analysis->size, closure_env(fun));
+        GcRoot const frame_root(frame);
+        frame_bind(frame, closure_args(fun), vals);
+        return eval_body(analysis->code, frame);
+#endif
+    }
+
+    /* let and let* bind their vars in a new env, inits evaluated in the
+       outer env or, one after another, in the new one */
+    Expr make_let_env(Expr decls, Expr env, bool sequential)
+    {
+        Expr const ret = make_env(env);
+        GcRoot const ret_root(ret);
+        for (; decls; decls = cdr(decls))
+        {
+            Expr const decl = car(decls);
+            if (is_cons(decl))
+            {
+                Expr const val = cdr(decl) ? eval(cadr(decl), sequential ? ret : env) : nil;
+                GcRoot const val_root(val);
+                env_destructuring_bind(ret, car(decl), val);
+            }
+            else
+            {
+                env_def(ret, decl, nil);
+            }
+        }
+        return ret;
+    }
+
+    /* the analyzed let binds the vars of its names to the values of its
+       inits in a frame, or runs in env if it has no vars */
+    Expr make_let_frame(Expr names, Expr inits, Expr env)
+    {
+        if (!names)
+        {
+            return env;
+        }
+        U64 size = 0;
+        for (Expr tmp = names; tmp; tmp = cdr(tmp))
+        {
+            ++size;
+        }
+        Expr const frame = make_frame(names, size, env);
+        GcRoot const frame_root(frame);
+        for (U64 slot = 0; inits; inits = cdr(inits), ++slot)
+        {
+            frame_set(frame, slot, eval(car(inits), env));
+        }
+        return frame;
+    }
+
+    /* up to LISP_BUILTIN_MAX_ARITY args are evaluated into place, so a
+       builtin that does not want a list gets called without one */
+    Expr call_builtin(Expr fun, Expr args, Expr env)
+    {
+        U64 argc = 0;
+        for (Expr tmp = args; tmp && argc <= LISP_BUILTIN_MAX_ARITY; tmp = cdr(tmp))
+        {
+            ++argc;
+        }
+        if (argc > LISP_BUILTIN_MAX_ARITY)
+        {
+            Expr const vals = eval_list(args, env);
+            GcRoot const vals_root(vals);
+            return builtin_apply(fun, vals, env);
+        }
+
+        Expr vals[LISP_BUILTIN_MAX_ARITY] = { nil, nil, nil };
+        GcRoot const root0(vals[0]);
+        GcRoot const root1(vals[1]);
+        GcRoot const root2(vals[2]);
+        U64 slot = 0;
+        for (Expr tmp = args; tmp; tmp = cdr(tmp))
+        {
+            vals[slot++] = eval(car(tmp), env);
+        }
+        return builtin_call(fun, vals, argc, env);
+    }
+
+    Expr call_function(Expr fun, Expr vals, Expr env)
+    {
+        if (is_builtin_function(fun))
+        {
+            GcRoot const vals_root(vals);
+            return builtin_apply(fun, vals, env);
+        }
+        else if (is_function(fun))
+        {
+            return call(fun, vals);
+        }
+        else
+        {
+            LISP_FAIL("cannot apply %s\n", repr(fun));
+            return nil;
+        }
+    }
+
+    void enter()
+    {
+        ++m_depth;
+    }
+
+    /* nothing runs analyzed code once the outermost evaluation is done */
+    void leave()
+    {
+        if (!--m_depth)
+        {
+            drop_stale_analyses();
+        }
+    }
+
+    /* the outermost evaluation starts on the stack of the thread */
+    bool stack_low()
+    {
+        char here;
+        uintptr_t const addr = (uintptr_t) &here;
+        if (!m_depth)
+        {
+            m_low = native_stack_limit(addr);
+        }
+        return addr < m_low;
+    }
+
+    Expr on_new_stack(std::function<Expr()> const & func)
+    {
+#if LISP_EVAL_STACK_SEGMENTS
+        if (m_grown + LISP_EVAL_SEGMENT_SIZE > LISP_EVAL_STACK_LIMIT)
+        {
+            LISP_FAIL("evaluation stack limit of %" PRIu64 " bytes exceeded\n", (U64) LISP_EVAL_STACK_LIMIT);
+        }
+        char * const stack = take_segment();
+        EvalSegment segment;
+        segment.func = &func;
+        segment.ret = nil;
+        getcontext(&segment.context);
+        segment.context.uc_stack.ss_sp = stack;
+        segment.context.uc_stack.ss_size = LISP_EVAL_SEGMENT_SIZE;
+        segment.context.uc_link = &segment.caller;
+        U64 const data = (U64) (uintptr_t) &segment;
+        makecontext(&segment.context, (void (*)()) run_segment, 2, (unsigned) (data >> 32), (unsigned) data);
+
+        uintptr_t const low = m_low;
+        m_low = (uintptr_t) stack + LISP_NATIVE_STACK_RESERVE;
+        m_grown += LISP_EVAL_SEGMENT_SIZE;
+        enter();
+        swapcontext(&segment.caller, &segment.context);
+        m_grown -= LISP_EVAL_SEGMENT_SIZE;
+        m_low = low;
+        give_segment(stack);
+        leave();
+
+        if (segment.error)
+        {
+            std::rethrow_exception(segment.error);
+        }
+        return segment.ret;
+#else
+        (void) func;
+        LISP_FAIL("native stack limit exceeded\n");
+        return nil;
+#endif
+    }
+
+protected:
+#if LISP_EVAL_STACK_SEGMENTS
+    /* what a fail handler throws cannot unwind past the start of the
+       segment, so it is caught here and thrown again on the stack below */
+    static void run_segment(unsigned high, unsigned low)
+    {
+        EvalSegment * segment = (EvalSegment *) (uintptr_t) (((U64) high << 32) | low);
+        try
+        {
+            segment->ret = (*segment->func)();
+        }
+        catch (...)
+        {
+            segment->error = std::current_exception();
+        }
+    }
+
+    char * take_segment()
+    {
+        char * ret = m_spare;
+        m_spare = nullptr;
+        if (!ret)
+        {
+            ret = (char *) LISP_MALLOC(LISP_EVAL_SEGMENT_SIZE);
+        }
+        if (!ret)
+        {
+            LISP_FAIL("cannot allocate a stack segment of %d bytes\n", LISP_EVAL_SEGMENT_SIZE);
+        }
+        return ret;
+    }
+
+    void give_segment(char * stack)
     {
-        switch (expr_type(exp))
+        if (m_spare)
         {
-        case TYPE_NIL:
-        case TYPE_CHAR:
-        case TYPE_FIXNUM:
-        case TYPE_FLOAT:
-        case TYPE_STRING:
-        case TYPE_KEYWORD:
-#if LISP_WANT_POINTER
-        case TYPE_POINTER:
-#endif
-            return exp;
-        case TYPE_SYMBOL:
-#if LISP_WANT_GENSYM
-        case TYPE_GENSYM:
-#endif
-            return env_get(env, exp);
-        case TYPE_CONS:
-            return apply(car(exp), cdr(exp), env);
-        case TYPE_BUILTIN_SYMBOL:
-            return builtin_func(exp)(nil, env);
-        default:
-            LISP_FAIL("cannot evaluate %s\n", repr(exp));
-            return nil;
+            LISP_FREE(stack);
+        }
+        else
+        {
+            m_spare = stack;
         }
     }
+#endif
 
-    Expr eval_body(Expr exps, Expr env)
+    /* where the stack of the thread, which grows down from here, runs
+       low, its low end is looked up once per thread */
+    uintptr_t native_stack_limit(uintptr_t here)
     {
-        Expr ret = nil;
-        for (Expr tmp = exps; tmp; tmp = cdr(tmp))
+#if LISP_NATIVE_STACK_LIMIT
+        return here > LISP_NATIVE_STACK_LIMIT ? here - LISP_NATIVE_STACK_LIMIT : 0;
+#else
+        if (!m_stack_low || !pthread_equal(m_stack_thread, pthread_self()))
         {
-            Expr const exp = car(tmp);
-            ret = eval(exp, env);
+            m_stack_thread = pthread_self();
+            m_stack_low = native_stack_low(here);
         }
-        return ret;
+        return m_stack_low + LISP_NATIVE_STACK_RESERVE;
+#endif
     }
 
-    Expr eval_list(Expr exps, Expr env)
+#if !LISP_NATIVE_STACK_LIMIT
+    uintptr_t native_stack_low(uintptr_t here)
     {
-        Expr ret = nil;
-        for (Expr tmp = exps; tmp; tmp = cdr(tmp))
+#if defined(__APPLE__)
+        uintptr_t const top = (uintptr_t) pthread_get_stackaddr_np(pthread_self());
+        return top - pthread_get_stacksize_np(pthread_self());
+#else
+#if defined(__linux__)
+        pthread_attr_t attr;
+        if (!pthread_getattr_np(pthread_self(), &attr))
         {
-            Expr const exp = car(tmp);
-            ret = cons(eval(exp, env), ret);
+            void * addr = NULL;
+            size_t size = 0;
+            pthread_attr_getstack(&attr, &addr, &size);
+            pthread_attr_destroy(&attr);
+            if (addr)
+            {
+                return (uintptr_t) addr;
+            }
         }
-        return nreverse(ret);
+#endif
+        /* as much as the limit allows from here, 8 MB if there is none */
+        struct rlimit limit;
+        uintptr_t size = 8 * 1024 * 1024;
+        if (!getrlimit(RLIMIT_STACK, &limit) && limit.rlim_cur != RLIM_INFINITY)
+        {
+            size = (uintptr_t) limit.rlim_cur;
+        }
+        return here > size ? here - size : 0;
+#endif
     }
+#endif
 
-    Expr apply(Expr name, Expr args, Expr env)
+    /* runs a special up to the form it ends with, which is left in exp
+       to be evaluated in env in tail position, any other special is run
+       to the end and leaves its value in exp */
+    bool run_special(Expr special, Expr args, Expr & env, Expr & exp)
     {
-        if (is_builtin_function(name))
+        U64 const kind = builtin_special_kind(special);
+        switch (kind)
+        {
+        case SPECIAL_IF:
+            if (eval(car(args), env) != nil)
+            {
+                exp = cadr(args);
+            }
+            else
+            {
+                exp = cddr(args) ? caddr(args) : nil;
+            }
+            return true;
+        case SPECIAL_PROGN:
+            return run_body(args, env, exp);
+        case SPECIAL_WHEN:
+        case SPECIAL_UNLESS:
+            if ((eval(car(args), env) != nil) != (kind == SPECIAL_WHEN))
+            {
+                exp = nil;
+                return false;
+            }
+            return run_body(cdr(args), env, exp);
+        case SPECIAL_COND:
+            for (Expr clauses = args; clauses; clauses = cdr(clauses))
+            {
+                if (eval(caar(clauses), env) != nil)
+                {
+                    return run_body(cdar(clauses), env, exp);
+                }
+            }
+            exp = nil;
+            return false;
+        case SPECIAL_AND:
+        case SPECIAL_OR:
         {
-            return builtin_func(name)(eval_list(args, env), env);
+            bool const is_and = kind == SPECIAL_AND;
+            if (!args)
+            {
+                exp = is_and ? LISP_SYMBOL_T : nil;
+                return false;
+            }
+            for (; cdr(args); args = cdr(args))
+            {
+                exp = eval(car(args), env);
+                if ((exp != nil) != is_and)
+                {
+                    return false;
+                }
+            }
+            exp = car(args);
+            return true;
+        }
+        case SPECIAL_LET:
+        case SPECIAL_LET_STAR:
+            env = make_let_env(car(args), env, kind == SPECIAL_LET_STAR);
+            return run_body(cdr(args), env, exp);
+        case SPECIAL_FRAME_LET:
+            env = make_let_frame(car(args), cadr(args), env);
+            return run_body(cddr(args), env, exp);
+        default:
+            exp = builtin_func(special)(args, env);
+            return false;
         }
-        else if (is_builtin_special(name))
+    }
+
+    bool run_body(Expr body, Expr env, Expr & exp)
+    {
+        if (!body)
         {
-            return builtin_func(name)(args, env);
+            exp = nil;
+            return false;
         }
-        else if (is_function(name))
+        for (; cdr(body); body = cdr(body))
         {
-            return eval_body(closure_body(name),
-                             make_call_env_from(closure_env(name),
-                                                closure_args(name),
-                                                eval_list(args, env)));
+            eval(car(body), env);
         }
-        else if (is_macro(name))
+        exp = car(body);
+        return true;
+    }
+
+    /* sets up the body and env to run a call of fun in, unless it is up
+       to another engine */
+    bool enter(Expr fun, Expr vals, Expr & body, Expr & env)
+    {
+        Analysis * analysis = closure_analysis(fun);
+        if (analysis->dynamic)
         {
-            return eval(eval_body(closure_body(name),
-                                  make_call_env_from(closure_env(name),
-                                                     closure_args(name),
-                                                     args)),
-                        env);
+            body = closure_body(fun);
+            env = make_call_env_from(closure_env(fun), closure_args(fun), vals);
+            return true;
         }
-        else
+#if LISP_EVAL_ENGINE == LISP_EVAL_ENGINE_AST
+        body = analysis->code;
+        env = make_frame(analysis->names, analysis->size, closure_env(fun));
+        frame_bind(env, closure_args(fun), vals);
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    Expr outer_frame(Expr env, U64 depth)
+    {
+        for (; depth > 0; --depth)
         {
-            // TODO check for unlimited recursion
-            return apply(eval(name, env), args, env);
+            env = frame_outer(env);
         }
+        return env;
     }
 
-protected:
     void bind_args(Expr env, Expr vars, Expr vals)
     {
         env_destructuring_bind(env, vars, vals);
@@ -4120,6 +10371,16 @@ protected:
             env_def(env, vars, vals);
         }
     }
+
+private:
+    U64 m_depth;
+    uintptr_t m_low;
+    U64 m_grown;
+    char * m_spare;
+    uintptr_t m_stack_low;
+#if !LISP_NATIVE_STACK_LIMIT
+    pthread_t m_stack_thread;
+#endif
 };
 
 EvalImpl g_eval;
@@ -4134,11 +10395,52 @@ Expr eval_body(Expr exps, Expr env)
     return g_eval.eval_body(exps, env);
 }
 
-Expr apply(Expr name, Expr args, Expr env)
+Expr apply(Expr name, Expr form, Expr env)
+{
+    return g_eval.apply(name, form, env);
+}
+
+Expr call_closure(Expr fun, Expr vals)
+{
+    return g_eval.call(fun, vals);
+}
+
+Expr call_function(Expr fun, Expr vals, Expr env)
+{
+    return g_eval.call_function(fun, vals, env);
+}
+
+Expr make_let_env(Expr decls, Expr env, bool sequential)
+{
+    return g_eval.make_let_env(decls, env, sequential);
+}
+
+Expr make_let_frame(Expr names, Expr inits, Expr env)
 {
-    return g_eval.apply(name, args, env);
+    return g_eval.make_let_frame(names, inits, env);
 }
 
+void eval_enter()
+{
+    g_eval.enter();
+}
+
+void eval_leave()
+{
+    g_eval.leave();
+}
+
+bool eval_stack_low()
+{
+    return g_eval.stack_low();
+}
+
+Expr eval_on_new_stack(std::function<Expr()> const & func)
+{
+    return g_eval.on_new_stack(func);
+}
+
+
 #ifdef LISP_NAMESPACE
 }
 #endif
@@ -4208,6 +10510,25 @@ static U32 utf8_decode_one(U8 const * buf) // TODO replace/retire this?
     return val;
 }
 
+/* checks pred for each adjacent pair, (< a b c) is (and (< a b) (< b c)) */
+static Expr number_chain(Expr const * args, U64 argc, bool (*pred)(Expr, Expr))
+{
+    for (U64 i = 1; i < argc; ++i)
+    {
+        if (!pred(args[i - 1], args[i]))
+        {
+            return nil;
+        }
+    }
+    return LISP_SYMBOL_T;
+}
+
+/* binds one of the specials that the evaluators run themselves */
+static void lang_defspecial_kind(Expr env, char const * name, U64 kind, BuiltinFunc func)
+{
+    env_def(env, intern(name), make_builtin_special_kind(name, kind, func));
+}
+
 Expr make_core_env()
 {
     Expr env = make_env(nil);
@@ -4221,7 +10542,7 @@ Expr make_core_env()
 
     lang_defspecial_quote(env);
 
-    lang_defspecial(env, "if", [](Expr args, Expr env) -> Expr
+    lang_defspecial_kind(env, "if", SPECIAL_IF, [](Expr args, Expr env) -> Expr
     {
         if (eval(car(args), env) != nil)
         {
@@ -4237,75 +10558,380 @@ Expr make_core_env()
         }
     });
 
-    lang_defspecial_while(env);
+    lang_defspecial_while(env);
+
+    lang_defspecial_kind(env, "def", SPECIAL_DEF, [](Expr args, Expr env) -> Expr
+    {
+        lang_def(env, car(args), eval(cadr(args), env));
+        return nil;
+    });
+
+    lang_defspecial_kind(env, "lambda", SPECIAL_LAMBDA, [](Expr args, Expr env) -> Expr
+    {
+        Expr const fun_args = car(args);
+        Expr const fun_body = cdr(args);
+        return make_function(env, nil, fun_args, fun_body);
+    });
+
+    lang_defspecial_kind(env, "syntax", SPECIAL_SYNTAX, [](Expr args, Expr env) -> Expr
+    {
+        Expr const mac_args = car(args);
+        Expr const mac_body = cdr(args);
+        return make_macro(env, nil, mac_args, mac_body);
+    });
+
+    lang_defspecial_kind(env, "backquote", SPECIAL_BACKQUOTE, [](Expr args, Expr env) -> Expr
+    {
+        return backquote(car(args), env);
+    });
+
+    /* these run in the loop of apply() when they are evaluated from
+       there, see EvalImpl::run_special */
+
+    lang_defspecial_kind(env, "progn", SPECIAL_PROGN, [](Expr args, Expr env) -> Expr
+    {
+        return eval_body(args, env);
+    });
+
+    lang_defspecial_kind(env, "let", SPECIAL_LET, [](Expr args, Expr env) -> Expr
+    {
+        Expr const let_env = make_let_env(car(args), env, false);
+        GcRoot const let_env_root(let_env);
+        return eval_body(cdr(args), let_env);
+    });
+
+    lang_defspecial_kind(env, "let*", SPECIAL_LET_STAR, [](Expr args, Expr env) -> Expr
+    {
+        Expr const let_env = make_let_env(car(args), env, true);
+        GcRoot const let_env_root(let_env);
+        return eval_body(cdr(args), let_env);
+    });
+
+    lang_defspecial_kind(env, "cond", SPECIAL_COND, [](Expr args, Expr env) -> Expr
+    {
+        for (Expr clauses = args; clauses; clauses = cdr(clauses))
+        {
+            if (eval(caar(clauses), env) != nil)
+            {
+                return eval_body(cdar(clauses), env);
+            }
+        }
+        return nil;
+    });
+
+    lang_defspecial_kind(env, "when", SPECIAL_WHEN, [](Expr args, Expr env) -> Expr
+    {
+        return eval(car(args), env) != nil ? eval_body(cdr(args), env) : nil;
+    });
+
+    lang_defspecial_kind(env, "unless", SPECIAL_UNLESS, [](Expr args, Expr env) -> Expr
+    {
+        return eval(car(args), env) == nil ? eval_body(cdr(args), env) : nil;
+    });
+
+    lang_defspecial_kind(env, "and", SPECIAL_AND, [](Expr args, Expr env) -> Expr
+    {
+        Expr ret = LISP_SYMBOL_T;
+        for (; args && ret != nil; args = cdr(args))
+        {
+            ret = eval(car(args), env);
+        }
+        return ret;
+    });
+
+    lang_defspecial_kind(env, "or", SPECIAL_OR, [](Expr args, Expr env) -> Expr
+    {
+        Expr ret = nil;
+        for (; args && ret == nil; args = cdr(args))
+        {
+            ret = eval(car(args), env);
+        }
+        return ret;
+    });
+
+    lang_defun_args(env, "eq", [](Expr const * args, U64 argc) -> Expr
+    {
+        if (argc < 2)
+        {
+            LISP_FAIL("not enough arguments in call to eq\n");
+        }
+        for (U64 i = 1; i < argc; ++i)
+        {
+            if (!eq(args[0], args[i]))
+            {
+                return nil;
+            }
+        }
+        return LISP_SYMBOL_T;
+    });
+
+    lang_defun_args(env, "equal", [](Expr const * args, U64 argc) -> Expr
+    {
+        if (argc < 2)
+        {
+            LISP_FAIL("not enough arguments in call to equal\n");
+        }
+        for (U64 i = 1; i < argc; ++i)
+        {
+            if (!equal(args[0], args[i]))
+            {
+                return nil;
+            }
+        }
+        return LISP_SYMBOL_T;
+    });
+
+    lang_defun2(env, "cons", [](Expr arg1, Expr arg2) -> Expr
+    {
+        return cons(arg1, arg2);
+    });
+
+    lang_defun1(env, "car", [](Expr arg1) -> Expr
+    {
+        return car(arg1);
+    });
+
+    lang_defun1(env, "cdr", [](Expr arg1) -> Expr
+    {
+        return cdr(arg1);
+    });
+
+    lang_defun2(env, "rplaca", [](Expr arg1, Expr arg2) -> Expr
+    {
+        rplaca(arg1, arg2);
+        return nil;
+    });
+
+    lang_defun2(env, "rplacd", [](Expr arg1, Expr arg2) -> Expr
+    {
+        rplacd(arg1, arg2);
+        return nil;
+    });
+
+    lang_defun1(env, "not", [](Expr arg1) -> Expr
+    {
+        return arg1 ? nil : LISP_SYMBOL_T;
+    });
+
+    lang_defun1(env, "caar", [](Expr arg1) -> Expr
+    {
+        return caar(arg1);
+    });
+
+    lang_defun1(env, "cadr", [](Expr arg1) -> Expr
+    {
+        return cadr(arg1);
+    });
+
+    lang_defun1(env, "cdar", [](Expr arg1) -> Expr
+    {
+        return cdar(arg1);
+    });
+
+    lang_defun1(env, "cddr", [](Expr arg1) -> Expr
+    {
+        return cddr(arg1);
+    });
+
+    lang_defun1(env, "caddr", [](Expr arg1) -> Expr
+    {
+        return caddr(arg1);
+    });
+
+    lang_defun1(env, "cadddr", [](Expr arg1) -> Expr
+    {
+        return cadddr(arg1);
+    });
+
+    lang_defun1(env, "length", [](Expr arg1) -> Expr
+    {
+        return make_number((I64) length(arg1));
+    });
+
+    lang_defun1(env, "reverse", [](Expr arg1) -> Expr
+    {
+        return reverse(arg1);
+    });
 
-    lang_defspecial(env, "def", [](Expr args, Expr env) -> Expr
+    lang_defun1(env, "nreverse", [](Expr arg1) -> Expr
     {
-        lang_def(env, car(args), eval(cadr(args), env));
-        return nil;
+        return nreverse(arg1);
     });
 
-    lang_defspecial(env, "lambda", [](Expr args, Expr env) -> Expr
+    lang_defun1(env, "copy-list", [](Expr arg1) -> Expr
     {
-        Expr const fun_args = car(args);
-        Expr const fun_body = cdr(args);
-        return make_function(env, nil, fun_args, fun_body);
+        return copy_list(arg1);
     });
 
-    lang_defspecial(env, "syntax", [](Expr args, Expr env) -> Expr
+    /* the args are a fresh list, unless they come from apply, whose last
+       arg the result may share structure with */
+    lang_defun(env, "list", [](Expr args, Expr) -> Expr
     {
-        Expr const mac_args = car(args);
-        Expr const mac_body = cdr(args);
-        return make_macro(env, nil, mac_args, mac_body);
+        return args;
     });
 
-    lang_defspecial(env, "backquote", [](Expr args, Expr env) -> Expr
+    lang_defun(env, "list*", [](Expr args, Expr) -> Expr
     {
-        return backquote(car(args), env);
+        if (!args || !cdr(args))
+        {
+            return car(args);
+        }
+        Expr const ret = copy_list(args);
+        Expr tail = ret;
+        while (cddr(tail))
+        {
+            tail = cdr(tail);
+        }
+        rplacd(tail, cadr(tail));
+        return ret;
     });
 
-    lang_defun(env, "eq", [](Expr args, Expr) -> Expr
+    lang_defun(env, "append", [](Expr args, Expr) -> Expr
     {
-        return all_eq(args) ? LISP_SYMBOL_T : nil; // TODO use make_truth()
+        if (!args)
+        {
+            return nil;
+        }
+        Expr ret = nil;
+        Expr tail = nil;
+        for (; cdr(args); args = cdr(args))
+        {
+            for (Expr seq = car(args); is_cons(seq); seq = cdr(seq))
+            {
+                Expr const next = cons(car(seq), nil);
+                if (tail)
+                {
+                    rplacd(tail, next);
+                }
+                else
+                {
+                    ret = next;
+                }
+                tail = next;
+            }
+        }
+        if (tail)
+        {
+            rplacd(tail, car(args));
+            return ret;
+        }
+        return car(args);
     });
 
-    lang_defun(env, "equal", [](Expr args, Expr) -> Expr
+    lang_defun2(env, "nth", [](Expr arg1, Expr arg2) -> Expr
     {
-        return all_equal(args) ? LISP_SYMBOL_T : nil; // TODO use make_truth()
+        return nth((U64) fixnum_value(arg1), arg2);
     });
 
-    lang_defun(env, "cons", [](Expr args, Expr) -> Expr
+    lang_defun2(env, "nthcdr", [](Expr arg1, Expr arg2) -> Expr
     {
-        return cons(car(args), cadr(args));
+        return nthcdr((U64) fixnum_value(arg1), arg2);
     });
 
-    lang_defun(env, "car", [](Expr args, Expr) -> Expr
+    lang_defun1(env, "last", [](Expr arg1) -> Expr
     {
-        return car(car(args));
+        return last(arg1);
     });
 
-    lang_defun(env, "cdr", [](Expr args, Expr) -> Expr
+    lang_defun2(env, "member", [](Expr arg1, Expr arg2) -> Expr
     {
-        return cdr(car(args));
+        return member(arg1, arg2);
     });
 
-    lang_defun(env, "rplaca", [](Expr args, Expr) -> Expr
+    lang_defun2(env, "assoc", [](Expr arg1, Expr arg2) -> Expr
     {
-        rplaca(car(args), cadr(args));
-        return nil;
+        return assoc(arg1, arg2);
     });
 
-    lang_defun(env, "rplacd", [](Expr args, Expr) -> Expr
+    /* the functions below call back into closures, which may collect */
+
+    BuiltinFunc const map = [](Expr args, Expr env) -> Expr
     {
-        rplacd(car(args), cadr(args));
-        return nil;
+        Expr const fun = car(args);
+        Expr ret = nil;
+        GcRoot const ret_root(ret);
+        if (!cddr(args))
+        {
+            for (Expr seq = cadr(args); is_cons(seq); seq = cdr(seq))
+            {
+                ret = cons(call_function(fun, cons(car(seq), nil), env), ret);
+            }
+            return nreverse(ret);
+        }
+
+        std::vector<Expr> seqs;
+        for (Expr tmp = cdr(args); tmp; tmp = cdr(tmp))
+        {
+            seqs.push_back(car(tmp));
+        }
+        for (;;)
+        {
+            Expr vals = nil;
+            for (size_t i = seqs.size(); i > 0; --i)
+            {
+                if (!is_cons(seqs[i - 1]))
+                {
+                    return nreverse(ret);
+                }
+                vals = cons(car(seqs[i - 1]), vals);
+                seqs[i - 1] = cdr(seqs[i - 1]);
+            }
+            ret = cons(call_function(fun, vals, env), ret);
+        }
+    };
+    lang_defun(env, "map", map);
+    lang_defun(env, "mapcar", map);
+
+    lang_defun(env, "filter", [](Expr args, Expr env) -> Expr
+    {
+        Expr const fun = car(args);
+        Expr ret = nil;
+        GcRoot const ret_root(ret);
+        for (Expr seq = cadr(args); is_cons(seq); seq = cdr(seq))
+        {
+            Expr const item = car(seq);
+            if (call_function(fun, cons(item, nil), env))
+            {
+                ret = cons(item, ret);
+            }
+        }
+        return nreverse(ret);
+    });
+
+    /* (reduce fun seq [init]) folds from the left, without init the
+       first item is the start, and fun is called with no args on an
+       empty seq like in common lisp */
+    lang_defun(env, "reduce", [](Expr args, Expr env) -> Expr
+    {
+        Expr const fun = car(args);
+        Expr seq = cadr(args);
+        Expr acc = nil;
+        GcRoot const acc_root(acc);
+        if (cddr(args))
+        {
+            acc = caddr(args);
+        }
+        else if (is_cons(seq))
+        {
+            acc = car(seq);
+            seq = cdr(seq);
+        }
+        else
+        {
+            return call_function(fun, nil, env);
+        }
+        for (; is_cons(seq); seq = cdr(seq))
+        {
+            acc = call_function(fun, list(acc, car(seq)), env);
+        }
+        return acc;
     });
 
     lang_defun_println(env, "println");
 
-    lang_defun(env, "intern", [](Expr args, Expr) -> Expr
+    lang_defun1(env, "intern", [](Expr arg1) -> Expr
     {
-        return intern(string_value(car(args)));
+        return intern(string_value(arg1));
     });
 
 #if LISP_WANT_GENSYM
@@ -4348,27 +10974,65 @@ Expr make_core_env()
         return nil;
     });
 
-    lang_defun(env, "ord", [](Expr args, Expr) -> Expr
+    lang_defun(env, "gc", [](Expr, Expr) -> Expr
+    {
+        return make_number(gc_collect());
+    });
+
+    lang_defun_typed(env, "flush", []()
+    {
+        stream_flush(stream_get_stdout());
+    });
+
+    lang_defun(env, "gc-stats", [](Expr, Expr) -> Expr
+    {
+        stream_flush(stream_get_stdout());
+        gc_print_stats(stdout);
+        return nil;
+    });
+
+    lang_defun(env, "macro-stats", [](Expr, Expr) -> Expr
+    {
+        stream_flush(stream_get_stdout());
+        macro_print_stats(stdout);
+        return nil;
+    });
+
+    lang_defun(env, "macroexpand-1", [](Expr args, Expr env) -> Expr
+    {
+        return macroexpand_1(first(args), env);
+    });
+
+    lang_defun(env, "macroexpand", [](Expr args, Expr env) -> Expr
+    {
+        return macroexpand(first(args), env);
+    });
+
+    lang_defun(env, "macroexpand-all", [](Expr args, Expr env) -> Expr
+    {
+        return macroexpand_all(first(args), env);
+    });
+
+    lang_defun1(env, "ord", [](Expr arg1) -> Expr
     {
-        return make_number(utf8_decode_one(string_value_utf8(car(args))));
+        return make_number(utf8_decode_one(string_value_utf8(arg1)));
     });
 
-    lang_defun(env, "chr", [](Expr args, Expr) -> Expr
+    lang_defun1(env, "chr", [](Expr arg1) -> Expr
     {
-        return make_string_from_utf32_char((U32) fixnum_value(car(args)));
+        return make_string_from_utf32_char((U32) fixnum_value(arg1));
     });
 
-    lang_defun(env, "type", [](Expr args, Expr) -> Expr
+    lang_defun1(env, "type", [](Expr arg1) -> Expr
     {
-        Expr const arg1 = car(args);
         return intern(type_name(expr_type(arg1)));
     });
 
     lang_defun(env, "apply", [](Expr args, Expr env) -> Expr
     {
-        Expr const name = car(args);
+        Expr const fun = car(args);
         Expr const vals = cadr(args);
-        return apply(name, vals, env);
+        return call_function(fun, vals, env);
     });
 
     lang_defun(env, "number-+", [](Expr args, Expr) -> Expr
@@ -4414,6 +11078,87 @@ Expr make_core_env()
         return number_div(builtin_arg1(args, fmt), builtin_arg2(args, fmt));
     });
 
+    lang_defun_args(env, "+", [](Expr const * args, U64 argc) -> Expr
+    {
+        Expr ret = make_number(0);
+        for (U64 i = 0; i < argc; ++i)
+        {
+            ret = number_add(ret, args[i]);
+        }
+        return ret;
+    });
+
+    lang_defun_args(env, "-", [](Expr const * args, U64 argc) -> Expr
+    {
+        if (argc == 0)
+        {
+            LISP_FAIL("- expects at least one argument\n");
+        }
+        if (argc == 1)
+        {
+            return number_neg(args[0]);
+        }
+        Expr ret = args[0];
+        for (U64 i = 1; i < argc; ++i)
+        {
+            ret = number_sub(ret, args[i]);
+        }
+        return ret;
+    });
+
+    lang_defun_args(env, "*", [](Expr const * args, U64 argc) -> Expr
+    {
+        Expr ret = make_number(1);
+        for (U64 i = 0; i < argc; ++i)
+        {
+            ret = number_mul(ret, args[i]);
+        }
+        return ret;
+    });
+
+    lang_defun_args(env, "/", [](Expr const * args, U64 argc) -> Expr
+    {
+        if (argc == 0)
+        {
+            LISP_FAIL("/ expects at least one argument\n");
+        }
+        if (argc == 1)
+        {
+            return number_div(make_number(1), args[0]);
+        }
+        Expr ret = args[0];
+        for (U64 i = 1; i < argc; ++i)
+        {
+            ret = number_div(ret, args[i]);
+        }
+        return ret;
+    });
+
+    lang_defun_args(env, "=", [](Expr const * args, U64 argc) -> Expr
+    {
+        return number_chain(args, argc, number_equal);
+    });
+
+    lang_defun_args(env, "<", [](Expr const * args, U64 argc) -> Expr
+    {
+        return number_chain(args, argc, number_lt);
+    });
+
+    lang_defun_args(env, "<=", [](Expr const * args, U64 argc) -> Expr
+    {
+        return number_chain(args, argc, number_le);
+    });
+
+    lang_defun_args(env, ">", [](Expr const * args, U64 argc) -> Expr
+    {
+        return number_chain(args, argc, [](Expr a, Expr b) { return number_lt(b, a); });
+    });
+
+    lang_defun_args(env, ">=", [](Expr const * args, U64 argc) -> Expr
+    {
+        return number_chain(args, argc, [](Expr a, Expr b) { return number_le(b, a); });
+    });
+
     return env;
 }
 
@@ -4427,6 +11172,26 @@ void lang_defun(Expr env, char const * name, BuiltinFunc func)
     env_def(env, intern(name), make_builtin_function(name, func));
 }
 
+void lang_defun1(Expr env, char const * name, BuiltinFunc1 func)
+{
+    env_def(env, intern(name), make_builtin_function1(name, func));
+}
+
+void lang_defun2(Expr env, char const * name, BuiltinFunc2 func)
+{
+    env_def(env, intern(name), make_builtin_function2(name, func));
+}
+
+void lang_defun3(Expr env, char const * name, BuiltinFunc3 func)
+{
+    env_def(env, intern(name), make_builtin_function3(name, func));
+}
+
+void lang_defun_args(Expr env, char const * name, BuiltinFuncArgs func)
+{
+    env_def(env, intern(name), make_builtin_function_args(name, func));
+}
+
 void lang_defun_println(Expr env, char const * name)
 {
     lang_defun(env, name, b_println);
@@ -4439,7 +11204,7 @@ void lang_defspecial(Expr env, char const * name, BuiltinFunc func)
 
 void lang_defspecial_quote(Expr env)
 {
-    lang_defspecial(env, "quote", [](Expr args, Expr) -> Expr
+    lang_defspecial_kind(env, "quote", SPECIAL_QUOTE, [](Expr args, Expr) -> Expr
     {
         return car(args);
     });
@@ -4447,7 +11212,7 @@ void lang_defspecial_quote(Expr env)
 
 void lang_defspecial_while(Expr env)
 {
-    lang_defspecial(env, "while", [](Expr args, Expr env) -> Expr
+    lang_defspecial_kind(env, "while", SPECIAL_WHILE, [](Expr args, Expr env) -> Expr
     {
         Expr const test = car(args);
         Expr const body = cdr(args);
@@ -4466,6 +11231,194 @@ void lang_defsym(Expr env, char const * name, BuiltinFunc func)
     env_def(env, intern(name), make_builtin_symbol(name, func));
 }
 
+/* how lang_defun_typed passes values between lisp and the host */
+
+template <typename Value>
+struct LangType;
+
+template <>
+struct LangType<Expr>
+{
+    static Expr unbox(Expr exp, char const *)
+    {
+        return exp;
+    }
+
+    static Expr box(Expr value)
+    {
+        return value;
+    }
+};
+
+template <>
+struct LangType<I64>
+{
+    static I64 unbox(Expr exp, char const * name)
+    {
+        if (!is_fixnum(exp))
+        {
+            LISP_FAIL("%s expects a fixnum, got %s\n", name, repr(exp));
+        }
+        return fixnum_value(exp);
+    }
+
+    static Expr box(I64 value)
+    {
+        return make_number(value);
+    }
+};
+
+template <>
+struct LangType<F32>
+{
+    static F32 unbox(Expr exp, char const * name)
+    {
+        if (is_float(exp))
+        {
+            return float_value(exp);
+        }
+        if (!is_fixnum(exp))
+        {
+            LISP_FAIL("%s expects a number, got %s\n", name, repr(exp));
+        }
+        return (F32) fixnum_value(exp);
+    }
+
+    static Expr box(F32 value)
+    {
+        return make_float(value);
+    }
+};
+
+template <>
+struct LangType<bool>
+{
+    static bool unbox(Expr exp, char const *)
+    {
+        return exp != nil;
+    }
+
+    static Expr box(bool value)
+    {
+        return value ? LISP_SYMBOL_T : nil;
+    }
+};
+
+template <>
+struct LangType<char const *>
+{
+    static char const * unbox(Expr exp, char const * name)
+    {
+        if (!is_string(exp))
+        {
+            LISP_FAIL("%s expects a string, got %s\n", name, repr(exp));
+        }
+        return string_value(exp);
+    }
+
+    static Expr box(char const * value)
+    {
+        return make_string(value);
+    }
+};
+
+template <U64... Indices>
+struct LangIndices
+{
+};
+
+template <U64 Count, U64... Indices>
+struct LangMakeIndices : LangMakeIndices<Count - 1, Count - 1, Indices...>
+{
+};
+
+template <U64... Indices>
+struct LangMakeIndices<0, Indices...>
+{
+    typedef LangIndices<Indices...> type;
+};
+
+/* unboxes the args in place on the stack of the caller, they are all
+   read before the host function runs, so it may call back into lisp */
+template <typename Func, typename Ret, typename... Args>
+struct LangTyped
+{
+    char const * name;
+    Func func;
+
+    static Expr call(void * data, Expr const * args)
+    {
+        LangTyped * typed = (LangTyped *) data;
+        return LangType<Ret>::box(typed->invoke(args, typename LangMakeIndices<sizeof...(Args)>::type()));
+    }
+
+    template <U64... Indices>
+    Ret invoke(Expr const * args, LangIndices<Indices...>)
+    {
+        (void) args;
+        return func(LangType<typename std::decay<Args>::type>::unbox(args[Indices], name)...);
+    }
+};
+
+template <typename Func, typename... Args>
+struct LangTyped<Func, void, Args...>
+{
+    char const * name;
+    Func func;
+
+    static Expr call(void * data, Expr const * args)
+    {
+        LangTyped * typed = (LangTyped *) data;
+        typed->invoke(args, typename LangMakeIndices<sizeof...(Args)>::type());
+        return nil;
+    }
+
+    template <U64... Indices>
+    void invoke(Expr const * args, LangIndices<Indices...>)
+    {
+        (void) args;
+        func(LangType<typename std::decay<Args>::type>::unbox(args[Indices], name)...);
+    }
+};
+
+/* finds the signature of a function pointer or of a lambda */
+template <typename Func>
+struct LangSignature : LangSignature<decltype(&Func::operator())>
+{
+};
+
+template <typename Ret, typename... Args>
+struct LangSignature<Ret (*)(Args...)>
+{
+    static U64 const arity = sizeof...(Args);
+
+    template <typename Func>
+    struct Typed
+    {
+        typedef LangTyped<Func, Ret, Args...> type;
+    };
+};
+
+template <typename Class, typename Ret, typename... Args>
+struct LangSignature<Ret (Class::*)(Args...) const> : LangSignature<Ret (*)(Args...)>
+{
+};
+
+template <typename Class, typename Ret, typename... Args>
+struct LangSignature<Ret (Class::*)(Args...)> : LangSignature<Ret (*)(Args...)>
+{
+};
+
+/* the builtin owns the adapter, it goes with the builtin table */
+template <typename Func>
+void lang_defun_typed(Expr env, char const * name, Func func)
+{
+    typedef LangSignature<Func> Signature;
+    typedef typename Signature::template Typed<Func>::type Typed;
+    std::shared_ptr<Typed> const typed(new Typed { name, func });
+    env_def(env, intern(name), make_builtin_function_data(name, Signature::arity, Typed::call, typed));
+}
+
 Expr vbuiltin_arg1(Expr args, char const * /*fmt*/, va_list /*ap*/)
 {
     // TODO add error checking
@@ -10,6 +10,7 @@ public:
     int main(int argc, char ** argv)
     {
         Expr env = make_env(nil);
+        GcRoot const env_root(env);
         lang_defspecial(env, "define", [this](Expr args, Expr env)
         {
             Expr const head = car(args);
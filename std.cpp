@@ -3,6 +3,7 @@
 #include "lisp.hpp"
 
 #include <time.h>
+#include <sys/resource.h>
 
 namespace lisp {
 
@@ -13,21 +14,32 @@ struct ReplError
 class StdReplErrorHandler : public ErrorHandler
 {
 public:
+    StdReplErrorHandler(FILE * file = stderr) : m_file(file)
+    {
+    }
+
     void vfail(char const * fmt, va_list ap)
     {
-        fprintf(m_file, LISP_RED "[FAIL] " LISP_RESET);
-        vfprintf(m_file, fmt, ap);
+        if (m_file)
+        {
+            stream_flush(stream_get_stdout());
+            fprintf(m_file, LISP_RED "[FAIL] " LISP_RESET);
+            vfprintf(m_file, fmt, ap);
+        }
         throw ReplError();
     }
 
     void vwarn(char const * fmt, va_list ap)
     {
-        fprintf(m_file, LISP_YELLOW "[WARN] " LISP_RESET);
-        vfprintf(m_file, fmt, ap);
+        if (m_file)
+        {
+            fprintf(m_file, LISP_YELLOW "[WARN] " LISP_RESET);
+            vfprintf(m_file, fmt, ap);
+        }
     }
 
 private:
-    FILE * m_file = stderr;
+    FILE * m_file;
 };
 
 class StdSystem
@@ -38,25 +50,12 @@ public:
         srand(time(NULL));
     }
 
-    Expr make_truth(bool value)
-    {
-        return value ? LISP_SYMBOL_T : nil;
-    }
-
     Expr make_core_env()
     {
         Expr env = ::make_core_env();
-        lang_defun(env, "coin", [this](Expr args, Expr) -> Expr
+        lang_defun_typed(env, "coin", []() -> bool
         {
-            LISP_ASSERT(args == nil);
-            return make_truth(rand() & 1);
-        });
-
-        lang_defun(env, "<", [this](Expr args, Expr) -> Expr
-        {
-            Expr exp1, exp2;
-            builtin_args(args, &exp1, &exp2, "< expects at least two arguments");
-            return make_truth(fixnum_lt(exp1, exp2));
+            return rand() & 1;
         });
 
         lang_defspecial(env, "with", [this](Expr args, Expr) -> Expr
@@ -100,15 +99,61 @@ public:
         else if (!strcmp("load", cmd))
         {
             Expr env = make_core_env();
+            GcRoot const env_root(env);
 
             for (int i = 2; i < argc; i++)
             {
-                load_file(argv[i], env);
+                if (!strcmp("--expand", argv[i]))
+                {
+                    macro_set_expand_on_load(true);
+                }
+                else
+                {
+                    load_file(argv[i], env);
+                }
+            }
+            if (macro_expand_on_load())
+            {
+                macro_print_stats(stderr);
+            }
+        }
+        else if (!strcmp("soak", cmd))
+        {
+            if (argc < 4)
+            {
+                fail("missing iteration count or files\n");
+            }
+            int const iterations = atoi(argv[2]);
+            Expr env = make_core_env();
+            GcRoot const env_root(env);
+
+            long warm = 0;
+            for (int i = 0; i < iterations; i++)
+            {
+                for (int j = 3; j < argc; j++)
+                {
+                    load_file(argv[j], env);
+                }
+                if (i == iterations / 4)
+                {
+                    warm = max_rss();
+                }
+            }
+
+            long const done = max_rss();
+            bool const flat = done - warm <= warm / 10;
+            fprintf(stderr, "%s soak: max rss %ld KiB after %d iteration(s), %ld KiB after %d\n",
+                    flat ? LISP_GREEN "PASS" LISP_RESET : LISP_RED "FAIL" LISP_RESET,
+                    warm, iterations / 4 + 1, done, iterations);
+            if (!flat)
+            {
+                return 1;
             }
         }
         else if (!strcmp("repl", cmd))
         {
             Expr env = make_core_env();
+            GcRoot const env_root(env);
 
             for (int i = 2; i < argc; i++)
             {
@@ -122,9 +167,9 @@ public:
         loop:
             {
                 /* read */
-                // TODO use global.stream.stdout
-                fprintf(stdout, "> ");
-                fflush(stdout);
+                Expr const out = stream_get_stdout();
+                stream_put_cstring(out, "> ");
+                stream_flush(out);
 
                 Expr exp = nil;
                 if (!maybe_parse_expr(in, &exp))
@@ -166,6 +211,12 @@ public:
         unit_test_util(test);
         unit_test_env(test);
         unit_test_eval(test);
+        unit_test_analyze(test);
+        unit_test_macro(test);
+        unit_test_builtin(test);
+        unit_test_closure(test);
+        unit_test_gc(test);
+        unit_test_depth(test);
     }
 
     void unit_test_expr(TestState * test)
@@ -211,6 +262,49 @@ public:
         LISP_TEST_ASSERT(test, is_stream(stream_get_stdin()));
         LISP_TEST_ASSERT(test, is_stream(stream_get_stdout()));
         LISP_TEST_ASSERT(test, is_stream(stream_get_stderr()));
+
+        /* a multi-byte char straddling the end of the first block, read back mapped */
+        U64 const count = LISP_STREAM_BLOCK_SIZE - 1;
+        Expr const out = make_file_output_stream_from_path("test.txt");
+        for (U64 i = 0; i < count; ++i)
+        {
+            stream_put_cchar(out, 'a');
+        }
+        stream_put_char(out, 0x3042);
+        stream_flush(out);
+        LISP_TEST_ASSERT(test, file_size("test.txt") == count + 3);
+        stream_release(out);
+
+        Expr const in = make_file_input_stream_from_path("test.txt");
+        U64 got = 0;
+        while (stream_peek_char(in) == 'a')
+        {
+            stream_skip_char(in);
+            ++got;
+        }
+        LISP_TEST_ASSERT(test, got == count);
+        LISP_TEST_ASSERT(test, stream_read_char(in) == 0x3042);
+        LISP_TEST_ASSERT(test, stream_at_end(in));
+        stream_release(in);
+
+        /* nothing to map, read through a file stream instead */
+        fclose(fopen("test.txt", "wb"));
+        Expr const empty = make_file_input_stream_from_path("test.txt");
+        LISP_TEST_ASSERT(test, stream_at_end(empty));
+        stream_release(empty);
+    }
+
+    long file_size(char const * path)
+    {
+        FILE * file = fopen(path, "rb");
+        if (!file)
+        {
+            return -1;
+        }
+        fseek(file, 0, SEEK_END);
+        long const size = ftell(file);
+        fclose(file);
+        return size;
     }
 
     void unit_test_reader(TestState * test)
@@ -226,6 +320,86 @@ public:
         LISP_TEST_ASSERT(test, equal(read_one_from_string("`foo"), make_backquote(foo)));
         LISP_TEST_ASSERT(test, equal(read_one_from_string(",foo"), list(intern("unquote"), foo)));
         LISP_TEST_ASSERT(test, equal(read_one_from_string(",@foo"), list(intern("unquote-splicing"), foo)));
+
+        /* runs longer than a scan block, with the stops the scalar code handles */
+        Expr const sym = intern("a-symbol-longer-than-sixteen-bytes");
+        LISP_TEST_ASSERT(test, read_one_from_string(" \t\n ; a comment\n\n a-symbol-longer-than-sixteen-bytes") == sym);
+        LISP_TEST_ASSERT(test, equal(read_one_from_string("(foo ; bar\n baz)"), list(foo, intern("baz"))));
+        LISP_TEST_ASSERT(test, !strcmp("long string with \"quotes\",\na newline and \xc3\xa4",
+                                       string_value(read_one_from_string("\"long string with \\\"quotes\\\",\\na newline and \xc3\xa4\""))));
+        LISP_TEST_ASSERT(test, !strcmp("sym-\xc3\xa4-after-a-non-ascii-char", symbol_name(read_one_from_string("sym-\xc3\xa4-after-a-non-ascii-char"))));
+
+        LISP_TEST_ASSERT(test, read_one_from_string("42") == make_fixnum(42));
+        LISP_TEST_ASSERT(test, read_one_from_string("-17") == make_fixnum(-17));
+        LISP_TEST_ASSERT(test, read_one_from_string("+5") == make_fixnum(5));
+        LISP_TEST_ASSERT(test, read_one_from_string("0x1F") == make_fixnum(31));
+        LISP_TEST_ASSERT(test, read_one_from_string("-0x10") == make_fixnum(-16));
+        LISP_TEST_ASSERT(test, read_one_from_string("36028797018963967") == make_fixnum(INT64_C(36028797018963967)));
+        LISP_TEST_ASSERT(test, read_one_from_string("-36028797018963968") == make_fixnum(-INT64_C(36028797018963968)));
+        LISP_TEST_ASSERT(test, eval_fails("36028797018963968", nil));
+        LISP_TEST_ASSERT(test, eval_fails("0x80000000000000", nil));
+        LISP_TEST_ASSERT(test, is_float(read_one_from_string("2.0")));
+        LISP_TEST_ASSERT(test, float_value(read_one_from_string("0.1")) == 0.1f);
+        LISP_TEST_ASSERT(test, float_value(read_one_from_string("-2.5e-3")) == -2.5e-3f);
+        LISP_TEST_ASSERT(test, float_value(read_one_from_string("1E3")) == 1000.0f);
+        LISP_TEST_ASSERT(test, float_value(read_one_from_string("16777217.0")) == 16777217.0f);
+        LISP_TEST_ASSERT(test, float_value(read_one_from_string("3.4028235e38")) == 3.4028235e38f);
+        LISP_TEST_ASSERT(test, float_value(read_one_from_string("1e-45")) == 1e-45f);
+        LISP_TEST_ASSERT(test, float_value(read_one_from_string("123456789012345678901234567890.5")) == 123456789012345678901234567890.5f);
+        LISP_TEST_ASSERT(test, read_one_from_string("1+") == intern("1+"));
+        LISP_TEST_ASSERT(test, read_one_from_string("-") == intern("-"));
+        LISP_TEST_ASSERT(test, read_one_from_string("1e") == intern("1e"));
+        LISP_TEST_ASSERT(test, read_one_from_string("0x") == intern("0x"));
+        LISP_TEST_ASSERT(test, read_one_from_string("0x1g") == intern("0x1g"));
+        LISP_TEST_ASSERT(test, equal(read_one_from_string("(1 . 2)"), cons(make_fixnum(1), make_fixnum(2))));
+
+        /* nesting is bounded by memory, not by the native stack */
+        {
+            std::string const src = std::string(200000, '(') + std::string(200000, ')');
+            Expr exp = read_one_from_string(src.c_str());
+            U64 depth = 0;
+            for (; is_cons(exp); exp = car(exp))
+            {
+                ++depth;
+            }
+            LISP_TEST_ASSERT(test, depth == 199999 && exp == nil);
+            LISP_TEST_ASSERT(test, eval_fails("((foo)", nil));
+        }
+
+        /* string literals are copied out of a buffer of the caller, who
+           may reuse it before the stream goes */
+        {
+            char src[] = "(\"first\" \"second\")";
+            Expr const in = make_string_input_stream(src);
+            Expr exp = nil;
+            LISP_TEST_ASSERT(test, maybe_parse_expr(in, &exp));
+            memset(src, 'x', sizeof(src) - 1);
+            LISP_TEST_ASSERT(test, string_length(car(exp)) == 5);
+            LISP_TEST_ASSERT(test, string_equal(car(exp), make_string("first")));
+            LISP_TEST_ASSERT(test, !strcmp("second", string_value(cadr(exp))));
+            stream_release(in);
+        }
+        /* and out of a mapped file, which goes with the stream */
+        {
+            FILE * file = fopen("test.txt", "wb");
+            fputs("(\"first\" \"second\")", file);
+            fclose(file);
+            Expr const in = make_file_input_stream_from_path("test.txt");
+            Expr exp = nil;
+            LISP_TEST_ASSERT(test, maybe_parse_expr(in, &exp));
+            GcRoot const exp_root(exp);
+            LISP_TEST_ASSERT(test, string_equal(car(exp), make_string("first")));
+            stream_release(in);
+            LISP_TEST_ASSERT(test, !strcmp("first", string_value(car(exp))));
+            LISP_TEST_ASSERT(test, !strcmp("second", string_value(cadr(exp))));
+        }
+        {
+            std::string const payload(10000, 'p');
+            std::string const plain = "\"" + payload + "\"";
+            std::string const escaped = "\"\\t" + payload + "\"";
+            LISP_TEST_ASSERT(test, string_value(read_one_from_string(plain.c_str())) == payload);
+            LISP_TEST_ASSERT(test, string_value(read_one_from_string(escaped.c_str())) == "\t" + payload);
+        }
     }
 
     void unit_test_printer(TestState * test)
@@ -303,6 +477,30 @@ public:
             LISP_TEST_ASSERT(test,  env_can_set(env2, foo));
             LISP_TEST_ASSERT(test, !env_can_set(env2, bar));
         }
+        {
+            Expr env1 = make_env(nil);
+            GcRoot const root(env1);
+            Expr env2 = make_env(env1);
+            Expr const foo = intern("foo");
+            Expr const sym = gensym();
+
+            env_def(env1, foo, foo);
+            env_def(env1, sym, foo);
+            env_set(env2, foo, sym);
+            env_set(env2, sym, sym);
+            LISP_TEST_ASSERT(test, env_get(env2, foo) == sym);
+            LISP_TEST_ASSERT(test, env_get(env2, sym) == sym);
+
+            env_def(env2, foo, nil);
+            LISP_TEST_ASSERT(test, env_get(env2, foo) == nil);
+            LISP_TEST_ASSERT(test, env_get(env1, foo) == sym);
+
+            env_del(env1, foo);
+            env_del(env1, sym);
+            LISP_TEST_ASSERT(test, !env_can_set(env1, foo));
+            LISP_TEST_ASSERT(test, !env_can_set(env1, sym));
+            LISP_TEST_ASSERT(test,  env_can_set(env2, foo));
+        }
     }
 
     char const * eval_src(char const * src, Expr env)
@@ -361,6 +559,363 @@ public:
 
             LISP_TEST_ASSERT(test, !strcmp("(foo bar)", eval_src("`(,@'(foo bar))", env)));
         }
+
+        {
+            /* a special of the host that takes the name of a core one */
+            Expr env = make_core_env();
+            GcRoot const env_root(env);
+            lang_defspecial(env, "if", [](Expr, Expr) -> Expr
+            {
+                return make_fixnum(42);
+            });
+            LISP_TEST_ASSERT(test, !strcmp("42", eval_src("(if nil 1 2)", env)));
+            eval_src("(def f (lambda () (if nil 1 2)))", env);
+            LISP_TEST_ASSERT(test, !strcmp("42", eval_src("(f)", env)));
+            LISP_TEST_ASSERT(test, !strcmp("42", eval_src("(f)", env)));
+        }
+    }
+
+    void unit_test_analyze(TestState * test)
+    {
+        LISP_TEST_GROUP(test, "analyze");
+        Expr env = make_core_env();
+        GcRoot const env_root(env);
+        {
+            Expr const fun = eval(read_one_from_string("(lambda (a b) (cons b a))"), env);
+            GcRoot const fun_root(fun);
+            Analysis const * analysis = closure_analysis(fun);
+            LISP_TEST_ASSERT(test, !analysis->dynamic);
+            LISP_TEST_ASSERT(test, analysis->size == 2);
+            LISP_TEST_ASSERT(test, !strcmp("((#:<global cons> #:<local 0 1> #:<local 0 0>))", repr(analysis->code)));
+            LISP_TEST_ASSERT(test, closure_analysis(fun) == analysis);
+        }
+        {
+            Expr const fun = eval(read_one_from_string("(lambda (a) (def b a) b)"), env);
+            GcRoot const fun_root(fun);
+            LISP_TEST_ASSERT(test, closure_analysis(fun)->dynamic);
+        }
+        {
+            Expr const fun = eval(read_one_from_string("(lambda (a) *env*)"), env);
+            GcRoot const fun_root(fun);
+            LISP_TEST_ASSERT(test, closure_analysis(fun)->dynamic);
+        }
+        {
+            Expr const fun = eval(read_one_from_string("(lambda (a) (let ((b a)) (cons a b)))"), env);
+            GcRoot const fun_root(fun);
+            Analysis const * analysis = closure_analysis(fun);
+            LISP_TEST_ASSERT(test, !analysis->dynamic);
+            LISP_TEST_ASSERT(test, !strcmp("((#:<special operator frame-let> (b) (#:<local 0 0>) (#:<global cons> #:<local 1 0> #:<local 0 0>)))", repr(analysis->code)));
+        }
+        {
+            /* a name that turns into a macro after the caller ran */
+            eval_src("(def g (lambda (x) (list 'fn x)))", env);
+            Expr const fun = eval(read_one_from_string("(lambda (y) (g y))"), env);
+            GcRoot const fun_root(fun);
+            env_def(env, intern("h"), fun);
+            LISP_TEST_ASSERT(test, !strcmp("(fn 1)", eval_src("(h 1)", env)));
+            gc_collect();
+            U64 const cached = analyses_cached();
+            eval_src("(def g (syntax (x) `(list 'mac ',x)))", env);
+            LISP_TEST_ASSERT(test, !strcmp("(mac y)", eval_src("(h 1)", env)));
+
+            /* the stale analyses are dropped, not kept around */
+            for (int i = 0; i < 10; ++i)
+            {
+                eval_src("(def g (lambda (x) (list 'fn x)))", env);
+                LISP_TEST_ASSERT(test, !strcmp("(fn 1)", eval_src("(h 1)", env)));
+                eval_src("(def g (syntax (x) `(list 'mac ',x)))", env);
+                LISP_TEST_ASSERT(test, !strcmp("(mac y)", eval_src("(h 1)", env)));
+            }
+            gc_collect();
+            LISP_TEST_ASSERT(test, analyses_cached() <= cached);
+        }
+    }
+
+    void unit_test_macro(TestState * test)
+    {
+        LISP_TEST_GROUP(test, "macro");
+        Expr env = make_core_env();
+        GcRoot const env_root(env);
+        eval(read_one_from_string("(def twice (syntax (x) `(cons ,x ,x)))"), env);
+
+        Expr const exp = read_one_from_string("(twice 'foo)");
+        GcRoot const exp_root(exp);
+        U64 const hits = macro_cache_hits();
+        U64 const misses = macro_cache_misses();
+        LISP_TEST_ASSERT(test, !strcmp("(foo . foo)", repr(eval(exp, env))));
+        LISP_TEST_ASSERT(test, !strcmp("(foo . foo)", repr(eval(exp, env))));
+        LISP_TEST_ASSERT(test, !strcmp("(foo . foo)", repr(eval(exp, env))));
+        LISP_TEST_ASSERT(test, macro_cache_misses() - misses == 1);
+        LISP_TEST_ASSERT(test, macro_cache_hits() - hits == 2);
+
+        gc_collect();
+        LISP_TEST_ASSERT(test, !strcmp("(foo . foo)", repr(eval(exp, env))));
+        LISP_TEST_ASSERT(test, macro_cache_misses() - misses == 1);
+
+        eval(read_one_from_string("(def twice (syntax (x) `(cons ,x (cons ,x nil))))"), env);
+        LISP_TEST_ASSERT(test, !strcmp("(foo foo)", repr(eval(exp, env))));
+        LISP_TEST_ASSERT(test, macro_cache_misses() - misses == 2);
+
+        /* closures that ran with the old macro expand the new one */
+        eval_src("(def twice-of (lambda (y) (twice y)))", env);
+        eval_src("(def call-twice-of (lambda (y) (twice-of y)))", env);
+        LISP_TEST_ASSERT(test, !strcmp("(5 5)", eval_src("(call-twice-of 5)", env)));
+        eval_src("(def twice (syntax (x) `(cons ,x ,x)))", env);
+        LISP_TEST_ASSERT(test, !strcmp("(5 . 5)", eval_src("(call-twice-of 5)", env)));
+        eval_src("(def twice (syntax (x) `(cons ,x (cons ,x nil))))", env);
+
+        LISP_TEST_ASSERT(test, !strcmp("(cons 'foo (cons 'foo nil))", eval_src("(macroexpand-1 '(twice 'foo))", env)));
+        LISP_TEST_ASSERT(test, !strcmp("(if a (cons b (cons b nil)))", eval_src("(macroexpand-all '(if a (twice b)))", env)));
+        LISP_TEST_ASSERT(test, !strcmp("'(twice b)", eval_src("(macroexpand-all ''(twice b))", env)));
+        LISP_TEST_ASSERT(test, !strcmp("(lambda (twice) (twice b))", eval_src("(macroexpand-all '(lambda (twice) (twice b)))", env)));
+
+        /* call sites without args are told apart by the call, not the args */
+        eval_src("(def expanded (list 0))", env);
+        eval_src("(def next (syntax () (rplaca expanded (+ (car expanded) 1)) (car expanded)))", env);
+        LISP_TEST_ASSERT(test, !strcmp("(1 2 3)", eval_src("(list (next) (next) (next))", env)));
+        eval_src("(def nexts (lambda () (list (next) (next))))", env);
+        LISP_TEST_ASSERT(test, !strcmp("(4 5)", eval_src("(nexts)", env)));
+        LISP_TEST_ASSERT(test, !strcmp("(4 5)", eval_src("(nexts)", env)));
+#if LISP_WANT_GENSYM
+        eval_src("(def fresh (syntax () `',(gensym)))", env);
+        LISP_TEST_ASSERT(test, !strcmp("nil", eval_src("(eq (fresh) (fresh))", env)));
+#endif
+
+        /* a macro takes the place of a special of the same name, also in
+           closures that were analyzed with the special */
+        {
+            Expr env = make_core_env();
+            GcRoot const env_root(env);
+            eval_src("(def g (lambda (x) (when x 1)))", env);
+            LISP_TEST_ASSERT(test, !strcmp("1", eval_src("(g t)", env)));
+            eval_src("(def when (syntax (test . body) `(if ,test 'macro)))", env);
+            LISP_TEST_ASSERT(test, !strcmp("macro", eval_src("(g t)", env)));
+            LISP_TEST_ASSERT(test, !strcmp("(if a 'macro)", eval_src("(macroexpand-all '(when a b))", env)));
+        }
+    }
+
+    /* allocations made by a call of f, after a call to warm it up */
+    U64 made_by_call(char const * src, Expr env)
+    {
+        Expr const exp = read_one_from_string(src);
+        GcRoot const root(exp);
+        eval(exp, env);
+        U64 const made = gc_made();
+        eval(exp, env);
+        return gc_made() - made;
+    }
+
+    void unit_test_builtin(TestState * test)
+    {
+        LISP_TEST_GROUP(test, "builtin");
+        Expr env = make_core_env();
+        GcRoot const root(env);
+        eval_src("(def xs (cons 1 (cons 2 nil)))", env);
+        eval_src("(def count (lambda (n) (while (< 0 n) (def n (- n 1))) n))", env);
+        eval_src("(def walk (lambda (n) (while (< 0 n) (car (cdr xs)) (eq n n) (def n (- n 1))) n))", env);
+        eval_src("(def listy (lambda (n) (while (< 0 n) (list n n) (def n (- n 1))) n))", env);
+
+        /* the call to the closure itself makes a list of args and a frame */
+        U64 const base = made_by_call("(count 1)", env);
+        LISP_TEST_ASSERT(test, made_by_call("(count 1000)", env) == base);
+        LISP_TEST_ASSERT(test, made_by_call("(walk 1000)", env) == base);
+        LISP_TEST_ASSERT(test, made_by_call("(listy 1000)", env) >= base + 2000);
+
+        LISP_TEST_ASSERT(test, !strcmp("(2 . 1)", eval_src("(apply cons '(2 1))", env)));
+        LISP_TEST_ASSERT(test, !strcmp("6", eval_src("(apply + '(1 2 3))", env)));
+        LISP_TEST_ASSERT(test, eval_fails("(car)", env));
+        LISP_TEST_ASSERT(test, eval_fails("(cons 1 2 3)", env));
+        LISP_TEST_ASSERT(test, eval_fails("(apply car '(1 2))", env));
+
+        lang_defun_typed(env, "imax", [](I64 a, I64 b) -> I64
+        {
+            return a > b ? a : b;
+        });
+        lang_defun_typed(env, "half", [](F32 a) -> F32
+        {
+            return a / 2;
+        });
+        lang_defun_typed(env, "strlen", strlen_typed);
+        lang_defun_typed(env, "answer", []() -> Expr
+        {
+            return intern("yes");
+        });
+        LISP_TEST_ASSERT(test, !strcmp("3", eval_src("(imax 2 3)", env)));
+        LISP_TEST_ASSERT(test, !strcmp("1.500000", eval_src("(half 3)", env)));
+        LISP_TEST_ASSERT(test, !strcmp("3", eval_src("(strlen \"foo\")", env)));
+        LISP_TEST_ASSERT(test, !strcmp("yes", eval_src("(answer)", env)));
+        LISP_TEST_ASSERT(test, !strcmp("5", eval_src("(apply imax '(5 4))", env)));
+        LISP_TEST_ASSERT(test, eval_fails("(imax 1)", env));
+        LISP_TEST_ASSERT(test, eval_fails("(imax 1 'foo)", env));
+        LISP_TEST_ASSERT(test, eval_fails("(strlen 1)", env));
+
+        eval_src("(def maxes (lambda (n) (while (< 0 n) (imax n 1) (def n (- n 1))) n))", env);
+        LISP_TEST_ASSERT(test, made_by_call("(maxes 1000)", env) == base);
+    }
+
+    static I64 strlen_typed(char const * str)
+    {
+        return (I64) strlen(str);
+    }
+
+    void unit_test_closure(TestState * test)
+    {
+        LISP_TEST_GROUP(test, "closure");
+        Expr env = make_core_env();
+        GcRoot const root(env);
+        Expr const foo = intern("foo");
+        Expr const fun = make_function(env, foo, nil, nil);
+        LISP_TEST_ASSERT(test, is_function(fun));
+        LISP_TEST_ASSERT(test, closure_name(fun) == foo);
+#if !LISP_CLOSURE_USE_CONS
+        LISP_TEST_ASSERT(test, !strcmp("#:<function foo>", repr(fun)));
+#endif
+        LISP_TEST_ASSERT(test, is_macro(make_macro(env, nil, nil, nil)));
+        LISP_TEST_ASSERT(test, !is_function(list(foo, foo)));
+
+        /* lambdas in analyzed code keep only what they refer to */
+        eval_src("(def adder (lambda (n m) (lambda (x) (cons x n))))", env);
+        eval_src("(def peek (lambda (n m) (lambda () *env*)))", env);
+        Expr const add = eval(read_one_from_string("(adder 1 2)"), env);
+        Expr const add_env = closure_env(add);
+        LISP_TEST_ASSERT(test, is_frame(add_env) && frame_outer(add_env) == env);
+        LISP_TEST_ASSERT(test, !strcmp("(n)", repr(frame_names(add_env))));
+        Expr const peek = eval(read_one_from_string("(peek 1 2)"), env);
+        LISP_TEST_ASSERT(test, !strcmp("(n m)", repr(frame_names(closure_env(peek)))));
+#if LISP_CLOSURE_ACCEPT_LISTS
+        Expr const args = read_one_from_string("(x)");
+        Expr const body = read_one_from_string("((cons x x))");
+        env_def(env, intern("clo"), cons(LISP_SYM_LIT, cons(LISP_SYM_CLO, cons(env, cons(args, body)))));
+        LISP_TEST_ASSERT(test, !strcmp("(1 . 1)", eval_src("(clo 1)", env)));
+        gc_collect();
+        LISP_TEST_ASSERT(test, !strcmp("(2 . 2)", eval_src("(clo 2)", env)));
+        LISP_TEST_ASSERT(test, !is_function(read_one_from_string("(lit clo)")));
+#else
+        LISP_TEST_ASSERT(test, !strcmp("#:<function>", eval_src("(lambda (x) x)", env)));
+#endif
+    }
+
+    void unit_test_gc(TestState * test)
+    {
+        LISP_TEST_GROUP(test, "gc");
+        Expr const foo = intern("foo");
+        Expr const bar = intern("bar");
+        {
+            Expr exp = list(foo, make_string("bar"));
+            GcRoot const root(exp);
+            list(foo, bar);
+            LISP_TEST_ASSERT(test, gc_collect() > 0);
+            LISP_TEST_ASSERT(test, car(exp) == foo);
+            LISP_TEST_ASSERT(test, !strcmp("bar", string_value(cadr(exp))));
+        }
+        {
+            Expr const exp = cons(foo, bar);
+            gc_protect(exp);
+            gc_collect();
+            LISP_TEST_ASSERT(test, car(exp) == foo);
+            LISP_TEST_ASSERT(test, cdr(exp) == bar);
+            gc_unprotect(exp);
+        }
+        {
+            Expr const exp = cons(nil, nil);
+            GcRoot const root(exp);
+            gc_collect();
+            rplaca(exp, list(foo, bar));
+            gc_collect_young();
+            LISP_TEST_ASSERT(test, equal(car(exp), list(foo, bar)));
+        }
+        {
+            Expr env = make_core_env();
+            GcRoot const root(env);
+            eval_src("(def xs (cons 'foo (cons 'bar nil)))", env);
+            gc_collect();
+            LISP_TEST_ASSERT(test, !strcmp("(foo bar)", eval_src("xs", env)));
+        }
+    }
+
+    bool eval_fails(char const * src, Expr env)
+    {
+        StdReplErrorHandler handler(nullptr);
+        error_push(&handler);
+        bool failed = false;
+        try
+        {
+            eval(read_one_from_string(src), env);
+        }
+        catch (ReplError)
+        {
+            failed = true;
+        }
+        error_pop();
+        return failed;
+    }
+
+    void unit_test_depth(TestState * test)
+    {
+        LISP_TEST_GROUP(test, "depth");
+        Expr env = make_core_env();
+        GcRoot const env_root(env);
+        eval_src("(def deep (lambda (n) (if (eq n 0) 0 (number-+ 1 (deep (number-- n 1))))))", env);
+        eval_src("(def deep-dynamic (lambda (n) (def m n) (if (eq m 0) 0 (number-+ 1 (deep-dynamic (number-- m 1))))))", env);
+        eval_src("(def nest (lambda (n) (def ret nil) (while (if (eq n 0) nil t) (def ret (cons ret nil)) (def n (number-- n 1))) ret))", env);
+
+#if LISP_EVAL_ENGINE == LISP_EVAL_ENGINE_VM
+        LISP_TEST_ASSERT(test, !strcmp("100000", eval_src("(deep 100000)", env)));
+#endif
+        LISP_TEST_ASSERT(test, eval_fails("(deep -1)", env));
+        LISP_TEST_ASSERT(test, eval_fails("(deep-dynamic -1)", env));
+        LISP_TEST_ASSERT(test, !strcmp("3", eval_src("(deep 3)", env)));
+
+        Expr const nested = eval(read_one_from_string("(nest 100000)"), env);
+        GcRoot const nested_root(nested);
+        LISP_TEST_ASSERT(test, equal(nested, eval(read_one_from_string("(nest 100000)"), env)));
+        LISP_TEST_ASSERT(test, !strcmp("((nil))", eval_src("(nest 2)", env)));
+
+#if !LISP_NATIVE_STACK_LIMIT
+        /* the native limit follows the stack of the thread, well under 4 MB
+           here, past it the evaluation goes on on segments if there are any */
+        DeepRun run = { this, env, false, "" };
+        pthread_attr_t attr;
+        pthread_attr_init(&attr);
+        pthread_attr_setstacksize(&attr, 1024 * 1024);
+        pthread_t thread;
+        LISP_TEST_ASSERT(test, !pthread_create(&thread, &attr, run_deep, &run));
+        pthread_join(thread, NULL);
+        pthread_attr_destroy(&attr);
+#if LISP_EVAL_STACK_SEGMENTS
+        LISP_TEST_ASSERT(test, run.ret == "100000");
+#else
+        LISP_TEST_ASSERT(test, run.failed);
+#endif
+#endif
+    }
+
+#if !LISP_NATIVE_STACK_LIMIT
+    struct DeepRun
+    {
+        StdSystem * system;
+        Expr env;
+        bool failed;
+        std::string ret;
+    };
+
+    static void * run_deep(void * data)
+    {
+        DeepRun * run = (DeepRun *) data;
+#if LISP_EVAL_STACK_SEGMENTS
+        run->ret = run->system->eval_src("(deep-dynamic 100000)", run->env);
+#else
+        run->failed = run->system->eval_fails("(deep-dynamic 100000)", run->env);
+#endif
+        return NULL;
+    }
+#endif
+
+    long max_rss()
+    {
+        struct rusage usage;
+        getrusage(RUSAGE_SELF, &usage);
+        return usage.ru_maxrss;
     }
 
     void fail(char const * fmt, ...)
@@ -378,6 +933,7 @@ public:
                 "  unit ......... run unit tests\n"
                 "  load {FILE} .. load source files\n"
                 "  repl {FILE} .. load source files, and drop into a repl\n"
+                "  soak {N} {FILE} .. load source files N times, check memory stays flat\n"
             );
         exit(1);
     }
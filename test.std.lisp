@@ -81,3 +81,161 @@
 (test (- 3 2) => 1)
 (test (* 3 2) => 6)
 (test (/ 4 2) => 2)
+(test (+) => 0)
+(test (+ 1 2 3) => 6)
+(test (- 3) => -3)
+(test (- 10 2 3) => 5)
+(test (/ 3 2) => 1.5)
+(test (/ 2) => 0.5)
+(test (+ 1 0.5) => 1.5)
+(test (* 0.5 3) => 1.5)
+(test (- 1.5) => -1.5)
+(test (< 1 2 3) => t)
+(test (< 1 3 2) => nil)
+(test (<= 1 1 2) => t)
+(test (> 3 2 1) => t)
+(test (>= 2 2 3) => nil)
+(test (= 2 2.0) => t)
+(test (< 1 1.5) => t)
+
+;;; closures
+
+(defun adder (n)
+  (lambda (x) (+ x n)))
+
+(test ((adder 2) 3) => 5)
+
+(defun swap ((a . b))
+  (cons b a))
+
+(test (swap '(1 . 2)) => (2 . 1))
+(test ((lambda (a (b c) . d) (list a b c d)) 1 '(2 3) 4 5) => (1 2 3 (4 5)))
+
+(defun bump (n)
+  (def n (+ n 1))
+  n)
+
+(test (bump 1) => 2)
+
+(defun local-def (n)
+  (def m (+ n 1))
+  m)
+
+(test (local-def 1) => 2)
+
+(defun quasi (x)
+  `(x ,x ,@(list x x)))
+
+(test (quasi 1) => (x 1 1 1))
+
+(defun nested (a)
+  (let ((b (+ a 1)))
+    ((lambda (c) (list a b c)) (+ b 1))))
+
+(test (nested 1) => (1 2 3))
+
+(defun bumped (n get)
+  (def get (lambda () n))
+  (def n (+ n 1))
+  (get))
+
+(test (bumped 1 nil) => 2)
+
+(defmacro get-n () 'n)
+
+(defun via-macro (n)
+  (lambda () (get-n)))
+
+(test ((via-macro 3)) => 3)
+
+(defun curry3 (a)
+  (lambda (b) (lambda (c) (list a b c))))
+
+(test (((curry3 1) 2) 3) => (1 2 3))
+(test (map (lambda (x) (list x (nested x))) '(1 2)) => ((1 (1 2 3)) (2 (2 3 4))))
+
+(test (apply list '(a b)) => (a b))
+(test (apply (lambda (a . b) (list b a)) '(1 2 3)) => ((2 3) 1))
+
+(defun count-down (n)
+  (if (eq n 0)
+      'done
+      (count-down (- n 1))))
+
+(test (count-down 10000) => done)
+
+;;; lists
+
+(test (list) => nil)
+(test (list 1 2 3) => (1 2 3))
+(test (list* 1 2 '(3)) => (1 2 3))
+(test (append) => nil)
+(test (append '(1) '(2 3) nil '(4) 5) => (1 2 3 4 . 5))
+(test (length '(1 2 3)) => 3)
+(test (reverse '(1 2 3)) => (3 2 1))
+(test (nreverse (list 1 2 3)) => (3 2 1))
+(test (copy-list '(1 2 . 3)) => (1 2 . 3))
+(test (last '(1 2 3)) => (3))
+(test (nth 1 '(a b c)) => b)
+(test (nth 5 '(a)) => nil)
+(test (nthcdr 2 '(a b c)) => (c))
+(test (member "b" '("a" "b" "c")) => ("b" "c"))
+(test (assoc 'b '((a . 1) (b . 2))) => (b . 2))
+(test (map (lambda (x) (+ x 1)) '(1 2 3)) => (2 3 4))
+(test (mapcar list '(1 2) '(a b) '(x y z)) => ((1 a x) (2 b y)))
+(test (filter (lambda (x) (not (eq x 2))) '(1 2 3)) => (1 3))
+(test (reduce + '(1 2 3)) => 6)
+(test (reduce + nil) => 0)
+(test (reduce cons '(1 2) 0) => ((0 . 1) . 2))
+(test (cadddr '(1 2 3 4)) => 4)
+
+;;; special forms
+
+(test (let ((a 1) (b 2)) (list a b)) => (1 2))
+(test (let ((a 1)) (let ((a 2) (b a)) (list a b))) => (2 1))
+(test (let (a (b)) (list a b)) => (nil nil))
+(test (let (((a . b) '(1 2))) (list a b)) => (1 (2)))
+(test (let* ((a 1) (b (+ a 1))) (list a b)) => (1 2))
+(test (let* ((a 1) (a (+ a 1))) a) => 2)
+(test (progn) => nil)
+(test (progn 1 2) => 2)
+(test (cond (nil 1) (t 2)) => 2)
+(test (cond (nil 1)) => nil)
+(test (when t 1 2) => 2)
+(test (when nil 1) => nil)
+(test (unless nil 1) => 1)
+(test (unless t 1) => nil)
+(test (and) => t)
+(test (and 1 2) => 2)
+(test (and 1 nil 2) => nil)
+(test (or) => nil)
+(test (or nil 2 3) => 2)
+(test (or nil nil) => nil)
+
+(defun specials (a b)
+  (let* ((c (+ a b))
+         (d (cond ((eq c 3) 'three) (t 'other))))
+    (list (and a b c) (or nil d) (when (eq a 1) 'one) (unless (eq a 1) 'one) (progn a b))))
+
+(test (specials 1 2) => (3 three one nil 2))
+
+(defun let-closures (n)
+  (if (eq n 0)
+      nil
+      (let ((m n))
+        (cons (lambda () m) (let-closures (- n 1))))))
+
+(test (map (lambda (f) (f)) (let-closures 3)) => (3 2 1))
+
+(defun let-def (n)
+  (let ((m n))
+    (def m (+ m 1))
+    m))
+
+(test (let-def 1) => 2)
+
+;;; gc
+
+(def gc-survivor (list 'a "b" 'c))
+(gc)
+(test gc-survivor => (a "b" c))
@@ -0,0 +1,23 @@
+;;; tail calls
+
+(defun count-to-zero (n)
+  (if (eq n 0)
+      'done
+      (count-to-zero (number-- n 1))))
+
+(test (count-to-zero 10000000) => done)
+
+(defun even? (n)
+  (if (eq n 0) t (odd? (number-- n 1))))
+
+(defun odd? (n)
+  (if (eq n 0) nil (even? (number-- n 1))))
+
+(test (even? 1000001) => nil)
+
+(defun let-to-zero (n)
+  (let ((m (number-- n 1)))
+    (cond ((eq m 0) 'done)
+          (t (when t (and t (or nil (let-to-zero m))))))))
+
+(test (let-to-zero 100000) => done)
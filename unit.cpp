@@ -45,6 +45,17 @@ static void test_symbol(TestState * test)
     LISP_TEST_GROUP(test, "symbol");
     LISP_TEST_ASSERT(test, is_symbol(make_symbol("foo")));
     LISP_TEST_ASSERT(test, !strcmp("foo", symbol_name(make_symbol("foo"))));
+    LISP_TEST_ASSERT(test, eq(make_symbol("foo"), make_symbol("foo")));
+    LISP_TEST_ASSERT(test, !eq(make_symbol("foo"), make_symbol("fop")));
+    LISP_TEST_ASSERT(test, !eq(make_symbol("foo"), make_symbol("foo-")));
+
+    LISP_TEST_ASSERT(test, eq(make_symbol("quote"), LISP_SYM_QUOTE));
+    LISP_TEST_ASSERT(test, eq(make_symbol("unquote-splicing"), LISP_SYM_UNQUOTE_SPLICING));
+    LISP_TEST_ASSERT(test, eq(make_symbol("."), LISP_SYM_DOT));
+
+    std::string long_name(3 * LISP_SYMBOL_CHUNK_SIZE, 'x');
+    LISP_TEST_ASSERT(test, !strcmp(long_name.c_str(), symbol_name(make_symbol(long_name.c_str()))));
+    LISP_TEST_ASSERT(test, eq(make_symbol(long_name.c_str()), make_symbol(long_name.c_str())));
 }
 
 static void test_cons(TestState * test)